@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Ray.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Axis-aligned bounding box. A default constructed box is empty and grows to fit whatever is added.
+struct AABB {
+	Point min;
+	Point max;
+
+	AABB() :
+		min(INF, INF, INF),
+		max(-INF, -INF, -INF) { }
+
+	AABB(const Point& lo, const Point& hi) : min(lo), max(hi) { }
+
+	void Grow(const Point& p) {
+		min = Point(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+		max = Point(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+	}
+
+	// Per bound rather than through Grow(Point), so growing by an empty box changes nothing.
+	void Grow(const AABB& box) {
+		min = Point(std::min(min.x, box.min.x), std::min(min.y, box.min.y), std::min(min.z, box.min.z));
+		max = Point(std::max(max.x, box.max.x), std::max(max.y, box.max.y), std::max(max.z, box.max.z));
+	}
+
+	bool Empty() const {
+		return min.x > max.x;
+	}
+
+	Point Center() const {
+		return 0.5 * (min + max);
+	}
+
+	double SurfaceArea() const {
+		if (Empty()) {
+			return 0.0;
+		}
+		Vec3 d = max - min;
+		return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	int LongestAxis() const {
+		Vec3 d = max - min;
+		if (d.x > d.y && d.x > d.z) {
+			return 0;
+		}
+		return d.y > d.z ? 1 : 2;
+	}
+
+	// Slab test against [tmin, tmax]; on a hit tnear holds the entry distance.
+	// Exit distances are pushed out by a few ulps (Ize, "Robust BVH Ray Traversal", 2013), so
+	// rounding never lets a ray pass between boxes sharing a face or miss a flat box.
+	bool Hit(const Ray& r, double tmin, double tmax, double& tnear) const {
+		for (int axis = 0; axis < 3; ++axis) {
+			const int s = r.sign(axis);
+			double t0 = ((s ? max : min)[axis] - r.origin()[axis]) * r.invDirection()[axis];
+			double t1 = ((s ? min : max)[axis] - r.origin()[axis]) * r.invDirection()[axis] * EXIT_SCALE;
+			tmin = t0 > tmin ? t0 : tmin;
+			tmax = t1 < tmax ? t1 : tmax;
+			if (tmax < tmin) {
+				return false;
+			}
+		}
+		tnear = tmin;
+		return true;
+	}
+
+private:
+	static constexpr double INF = std::numeric_limits<double>::infinity();
+	static constexpr double EXIT_SCALE = 1.0 + 4.0 * std::numeric_limits<double>::epsilon();
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Replaces a file in one step. Everything is written to `path`.tmp, and Commit() forces it to
+// disk before renaming it over `path`, so after a crash `path` holds either the old contents or
+// all of the new ones. A file that is not committed, or whose writes failed, is removed again.
+class AtomicFile {
+public:
+	explicit AtomicFile(const std::string& path) : m_path(path), m_temporary(path + ".tmp"), m_position(0) {
+		m_file = std::fopen(m_temporary.c_str(), "wb");
+		m_ok = m_file != nullptr;
+	}
+
+	~AtomicFile() {
+		if (m_file) {
+			std::fclose(m_file);
+			std::remove(m_temporary.c_str());
+		}
+	}
+
+	AtomicFile(const AtomicFile&) = delete;
+	AtomicFile& operator=(const AtomicFile&) = delete;
+
+	bool Write(const void* data, size_t bytes) {
+		if (m_ok && bytes > 0) {
+			m_ok = std::fwrite(data, 1, bytes, m_file) == bytes;
+			m_position += bytes;
+		}
+		return m_ok;
+	}
+
+	// Bytes written so far.
+	uint64_t Position() const {
+		return m_position;
+	}
+
+	bool Commit() {
+		if (!m_file) {
+			return false;
+		}
+		bool ok = m_ok && std::fflush(m_file) == 0 && Sync();
+		ok = std::fclose(m_file) == 0 && ok;
+		m_file = nullptr;
+		if (ok) {
+			std::error_code ec;
+			std::filesystem::rename(m_temporary, m_path, ec);
+			ok = !ec;
+		}
+		if (!ok) {
+			std::remove(m_temporary.c_str());
+		}
+		return ok;
+	}
+
+private:
+	bool Sync() {
+#ifdef _WIN32
+		const HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(m_file)));
+		return handle != INVALID_HANDLE_VALUE && FlushFileBuffers(handle);
+#else
+		return fsync(fileno(m_file)) == 0;
+#endif
+	}
+
+	std::string m_path;
+	std::string m_temporary;
+	FILE* m_file;
+	uint64_t m_position;
+	bool m_ok;
+};
@@ -0,0 +1,932 @@
+#pragma once
+
+#include "AABB.hpp"
+#include "FlatArray.hpp"
+#include "Scheduler.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Bounding volume hierarchy over an indexed set of primitive bounds.
+// Only indices are stored, so the owner decides what a primitive is and how to intersect it.
+class BVH {
+public:
+	// Nodes are laid out depth-first: the left child of an interior node directly follows it,
+	// `offset` is the right child. For a leaf `offset` is the first entry in the index array.
+	struct Node {
+		AABB bounds;
+		uint32_t offset = 0;
+		uint32_t count = 0;
+
+		bool isLeaf() const {
+			return count > 0;
+		}
+	};
+
+	BVH() : m_nodes(), m_indices(), m_parents(), m_leafOf(), m_dirty(), m_dirtyNodes(), m_cost(0.0) { }
+
+	// Non-owning view of a tree built earlier, e.g. in a mapped scene cache. It has no
+	// Indices(); its leaves refer to primitives already stored in leaf order.
+	static BVH View(const Node* nodes, size_t count) {
+		BVH bvh;
+		bvh.m_nodes = FlatArray<Node>::View(nodes, count);
+		return bvh;
+	}
+
+	// How much build time to spend for trace speed.
+	enum class BuildQuality {
+		// Linear BVH: primitives sorted along a Morton curve and split where their codes first differ.
+		Fast,
+		// Binned SAH down to LBVH_CLUSTER_SIZE primitives, linear BVHs below that.
+		Balanced,
+		// Binned SAH all the way down.
+		High
+	};
+
+	// Builds over `bounds`, spreading the work over `pool` when one is given. The tree depends
+	// only on the bounds and the quality, never on the number of threads.
+	void Build(const std::vector<AABB>& bounds, BuildQuality quality = BuildQuality::High, ThreadPool* pool = nullptr) {
+		Clear();
+		if (bounds.empty()) {
+			return;
+		}
+		m_indices.resize(bounds.size());
+		Builder(bounds, quality, pool, m_indices.begin()).Run(m_nodes);
+	}
+
+	void Clear() {
+		m_nodes.clear();
+		m_indices.clear();
+		m_parents.clear();
+		m_leafOf.clear();
+		m_dirty.clear();
+		m_dirtyNodes.clear();
+		m_cost = 0.0;
+	}
+
+	bool Empty() const {
+		return m_nodes.empty();
+	}
+
+	size_t NodeCount() const {
+		return m_nodes.size();
+	}
+
+	const AABB& Bounds() const {
+		return m_nodes[0].bounds;
+	}
+
+	const Node* Nodes() const {
+		return m_nodes.data();
+	}
+
+	// Whether the nodes are laid out the way Build() lays them out, every subtree right after
+	// its parent, with leaves inside `primitiveCount` primitives and no path deeper than
+	// traversal can follow. Trees that come from outside, like a View() of a file, need this.
+	bool IsWellFormed(size_t primitiveCount) const {
+		struct Subtree {
+			uint32_t node;
+			uint32_t end;
+			int depth;
+		};
+		if (m_nodes.size() >= NO_NODE) {
+			return false;
+		}
+		std::vector<Subtree> pending;
+		if (!m_nodes.empty()) {
+			pending.push_back({ 0, (uint32_t)m_nodes.size(), 1 });
+		}
+		while (!pending.empty()) {
+			const Subtree subtree = pending.back();
+			pending.pop_back();
+			const Node& node = m_nodes[subtree.node];
+			if (node.isLeaf()) {
+				if (subtree.node + 1 != subtree.end || node.offset > primitiveCount || node.count > primitiveCount - node.offset) {
+					return false;
+				}
+			}
+			else {
+				if (subtree.depth >= MAX_DEPTH || node.offset <= subtree.node + 1 || node.offset >= subtree.end) {
+					return false;
+				}
+				pending.push_back({ subtree.node + 1, node.offset, subtree.depth + 1 });
+				pending.push_back({ node.offset, subtree.end, subtree.depth + 1 });
+			}
+		}
+		return true;
+	}
+
+	// Build order of the primitives; leaves refer to contiguous ranges of it.
+	const FlatArray<uint32_t>& Indices() const {
+		return m_indices;
+	}
+
+	// Frees Indices() once the owner has stored its primitives in leaf order.
+	void ReleaseIndices() {
+		FlatArray<uint32_t>().swap(m_indices);
+	}
+
+	// Updates keep the topology and move only bounds: the owner changes primitives in place or
+	// points a leaf at a new range with SetLeaf(), marks what changed dirty, and Refit() then
+	// recomputes the dirty nodes bottom-up. The tree gets worse as things move; Cost() says how much.
+
+	// Sets up the parent links and the position-to-leaf map that updates need.
+	void EnableUpdates() {
+		const Node* nodes = m_nodes.data();
+		m_parents.assign(m_nodes.size(), NO_NODE);
+		m_dirty.assign(m_nodes.size(), 0);
+		m_dirtyNodes.clear();
+		m_leafOf.clear();
+		m_cost = 0.0;
+		for (uint32_t i = 0; i < m_nodes.size(); ++i) {
+			m_cost += nodes[i].bounds.SurfaceArea() * Weight(nodes[i]);
+			if (nodes[i].isLeaf()) {
+				MapLeaf(i, nodes[i].offset, nodes[i].count);
+			}
+			else {
+				m_parents[i + 1] = i;
+				m_parents[nodes[i].offset] = i;
+			}
+		}
+	}
+
+	bool UpdatesEnabled() const {
+		return !m_parents.empty();
+	}
+
+	// Leaf whose range holds index position `position`.
+	uint32_t LeafOf(uint32_t position) const {
+		return m_leafOf[position];
+	}
+
+	// Queues `node` and its ancestors for the next Refit().
+	void MarkDirty(uint32_t node) {
+		while (node != NO_NODE && !m_dirty[node]) {
+			m_dirty[node] = 1;
+			m_dirtyNodes.push_back(node);
+			node = m_parents[node];
+		}
+	}
+
+	size_t DirtyCount() const {
+		return m_dirtyNodes.size();
+	}
+
+	// Points leaf `node` at [first, first + count), count > 0, and marks it dirty.
+	void SetLeaf(uint32_t node, uint32_t first, uint32_t count) {
+		Node& leaf = m_nodes[node];
+		m_cost += leaf.bounds.SurfaceArea() * ((double)count - leaf.count);
+		leaf.offset = first;
+		leaf.count = count;
+		MapLeaf(node, first, count);
+		MarkDirty(node);
+	}
+
+	// Leaf to take a new primitive with bounds `box`: walks down towards the child whose area
+	// grows least, and on a tie the smaller one.
+	uint32_t FindInsertLeaf(const AABB& box) const {
+		const Node* nodes = m_nodes.data();
+		uint32_t current = 0;
+		while (!nodes[current].isLeaf()) {
+			const AABB& left = nodes[current + 1].bounds;
+			const AABB& right = nodes[nodes[current].offset].bounds;
+			const double leftGrowth = Grown(left, box).SurfaceArea() - left.SurfaceArea();
+			const double rightGrowth = Grown(right, box).SurfaceArea() - right.SurfaceArea();
+			const bool goLeft = leftGrowth < rightGrowth || (leftGrowth == rightGrowth && left.SurfaceArea() <= right.SurfaceArea());
+			current = goLeft ? current + 1 : nodes[current].offset;
+		}
+		return current;
+	}
+
+	// Recomputes the bounds of the dirty nodes, children before parents. leafBounds(first, count)
+	// returns the bounds of a leaf's range of primitives.
+	template <typename LeafBounds>
+	void Refit(LeafBounds&& leafBounds) {
+		// Children always come after their parent in the depth-first layout.
+		std::sort(m_dirtyNodes.begin(), m_dirtyNodes.end(), std::greater<uint32_t>());
+		for (const uint32_t index : m_dirtyNodes) {
+			Node& node = m_nodes[index];
+			const AABB box = node.isLeaf() ? leafBounds(node.offset, node.count)
+				: Grown(m_nodes[index + 1].bounds, m_nodes[node.offset].bounds);
+			m_cost += (box.SurfaceArea() - node.bounds.SurfaceArea()) * Weight(node);
+			node.bounds = box;
+			m_dirty[index] = 0;
+		}
+		m_dirtyNodes.clear();
+	}
+
+	// SAH cost per unit of root area, i.e. the expected node visits plus primitive tests of a
+	// ray that hits the root. Kept only while updates are enabled.
+	double Cost() const {
+		const double area = m_nodes.empty() ? 0.0 : m_nodes[0].bounds.SurfaceArea();
+		return area > 0.0 ? m_cost / area : 0.0;
+	}
+
+	// Visits leaves front to back, skipping any subtree that starts beyond `closest`.
+	// intersect(first, count, closest) is handed a leaf's range of Indices(), returns true
+	// on a hit and shrinks `closest` to it.
+	template <typename Intersect>
+	bool Traverse(const Ray& r, double tmin, double& closest, Intersect&& intersect) const {
+		if (m_nodes.empty()) {
+			return false;
+		}
+
+		double tnear;
+		if (!m_nodes[0].bounds.Hit(r, tmin, closest, tnear)) {
+			return false;
+		}
+
+		struct Entry {
+			uint32_t node;
+			double tnear;
+		} stack[MAX_DEPTH];
+		int top = 0;
+
+		bool hit = false;
+		uint32_t current = 0;
+		while (true) {
+			const Node& node = m_nodes[current];
+			if (node.isLeaf()) {
+				if (intersect(node.offset, node.count, closest)) {
+					hit = true;
+				}
+			}
+			else {
+				uint32_t nearChild = current + 1, farChild = node.offset;
+				double tNear, tFar;
+				bool hitNear = m_nodes[nearChild].bounds.Hit(r, tmin, closest, tNear);
+				bool hitFar = m_nodes[farChild].bounds.Hit(r, tmin, closest, tFar);
+
+				if (hitNear && hitFar) {
+					if (tFar < tNear) {
+						std::swap(nearChild, farChild);
+						std::swap(tNear, tFar);
+					}
+					stack[top++] = { farChild, tFar };
+					current = nearChild;
+					continue;
+				}
+				if (hitNear || hitFar) {
+					current = hitNear ? nearChild : farChild;
+					continue;
+				}
+			}
+
+			// Pop, dropping anything that now starts behind the closest hit.
+			while (top > 0 && stack[top - 1].tnear > closest) {
+				--top;
+			}
+			if (top == 0) {
+				break;
+			}
+			current = stack[--top].node;
+		}
+		return hit;
+	}
+
+	// Any-hit traversal for shadow rays: no ordering, stops at the first leaf where
+	// occluded(first, count) reports a hit within [tmin, tmax].
+	template <typename Occluded>
+	bool TraverseAny(const Ray& r, double tmin, double tmax, Occluded&& occluded) const {
+		if (m_nodes.empty()) {
+			return false;
+		}
+
+		uint32_t stack[MAX_DEPTH];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const uint32_t current = stack[--top];
+			const Node& node = m_nodes[current];
+			double tnear;
+			if (!node.bounds.Hit(r, tmin, tmax, tnear)) {
+				continue;
+			}
+			if (node.isLeaf()) {
+				if (occluded(node.offset, node.count)) {
+					return true;
+				}
+				continue;
+			}
+			stack[top++] = node.offset;
+			stack[top++] = current + 1;
+		}
+		return false;
+	}
+
+private:
+	static constexpr int BIN_COUNT = 16;
+	static constexpr uint32_t MAX_LEAF_SIZE = 4;
+	// Past this depth splits fall back to the object median, which keeps the
+	// tree shallow enough for the fixed traversal stack.
+	static constexpr int SAH_DEPTH_LIMIT = 32;
+	static constexpr int MAX_DEPTH = 64;
+
+	// Relative cost of a node visit against one primitive test.
+	static constexpr double TRAVERSAL_COST = 1.0;
+
+	static constexpr uint32_t NO_NODE = 0xffffffffu;
+
+	// Balanced builds switch from SAH to a linear BVH at this many primitives.
+	static constexpr uint32_t LBVH_CLUSTER_SIZE = 1024;
+	// Nodes larger than this are split one at a time by all threads together; smaller ones are
+	// built whole as independent tasks. Must exceed LBVH_CLUSTER_SIZE.
+	static constexpr uint32_t MIN_TASK_SIZE = 1 << 14;
+	static constexpr size_t TASKS_PER_WORKER = 8;
+	// Shared passes hand out this many blocks per worker so stealing can even out the load.
+	static constexpr size_t BLOCKS_PER_WORKER = 4;
+
+	// Morton codes interleave 10 bits per axis; the radix sort takes 10 bits per pass.
+	static constexpr int MORTON_BITS = 10;
+	static constexpr double MORTON_CELLS = 1 << MORTON_BITS;
+	static constexpr int RADIX_BITS = 10;
+	static constexpr uint32_t RADIX_SIZE = 1u << RADIX_BITS;
+
+	static double Weight(const Node& node) {
+		return node.isLeaf() ? node.count : TRAVERSAL_COST;
+	}
+
+	static AABB Grown(AABB box, const AABB& other) {
+		box.Grow(other);
+		return box;
+	}
+
+	void MapLeaf(uint32_t node, uint32_t first, uint32_t count) {
+		if (m_leafOf.size() < first + count) {
+			m_leafOf.resize(first + count, NO_NODE);
+		}
+		std::fill(m_leafOf.begin() + first, m_leafOf.begin() + first + count, node);
+	}
+
+	// A run of the index array with the bounds of its primitives and of their centers.
+	struct Range {
+		uint32_t first = 0;
+		uint32_t count = 0;
+		int depth = 0;
+		AABB box;
+		AABB centerBox;
+	};
+
+	struct Bins {
+		AABB bounds[3][BIN_COUNT];
+		uint32_t counts[3][BIN_COUNT] = {};
+	};
+
+	static int BinIndex(double center, double lo, double scale) {
+		int bin = (int)((center - lo) * scale);
+		return bin < BIN_COUNT ? bin : BIN_COUNT - 1;
+	}
+
+	// Moves bit i of a 10-bit value to bit 3i.
+	static uint32_t SpreadBits(uint32_t v) {
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	static uint32_t MortonCode(const Point& center, const AABB& centerBox) {
+		uint32_t code = 0;
+		for (int axis = 0; axis < 3; ++axis) {
+			const double extent = centerBox.max[axis] - centerBox.min[axis];
+			const double cell = extent > 0.0 ? (center[axis] - centerBox.min[axis]) / extent * MORTON_CELLS : 0.0;
+			code |= SpreadBits((uint32_t)std::min(cell, MORTON_CELLS - 1.0)) << (2 - axis);
+		}
+		return code;
+	}
+
+	// State of one Build(). The top of the tree is split node by node, each pass over a node's
+	// primitives shared by all threads; once nodes are small enough their subtrees are built
+	// serially as independent tasks and finally stitched into one depth-first array. Partitions
+	// are stable and the task size only decides who builds a node, never how, so any thread
+	// count gives the same tree.
+	class Builder {
+	public:
+		Builder(const std::vector<AABB>& bounds, BuildQuality quality, ThreadPool* pool, uint32_t* indices) :
+			m_bounds(bounds), m_quality(quality), m_pool(pool && pool->Size() > 1 ? pool : nullptr),
+			m_indices(indices), m_centers(bounds.size()), m_codes(),
+			m_scratch(quality == BuildQuality::Fast ? 0 : bounds.size()) { }
+
+		void Run(FlatArray<Node>& nodes) {
+			const uint32_t n = (uint32_t)m_bounds.size();
+			ForBlocks(0, n, true, [&](size_t, uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; ++i) {
+					m_indices[i] = i;
+					m_centers[i] = m_bounds[i].Center();
+				}
+			});
+			const Range root = Measure(0, n, 0, true);
+
+			if (m_quality != BuildQuality::High) {
+				m_codes.resize(n);
+			}
+			if (m_quality == BuildQuality::Fast) {
+				RadixSort(root.centerBox);
+			}
+
+			// Top of the tree, breadth-first: top[i] is the node made from pending[i].
+			const uint32_t taskSize = m_pool
+				? std::max(MIN_TASK_SIZE, (uint32_t)(n / (m_pool->Size() * TASKS_PER_WORKER))) : n;
+			std::vector<Range> pending(1, root);
+			std::vector<TopNode> top(1);
+			std::vector<Task> tasks;
+			for (size_t next = 0; next < pending.size(); ++next) {
+				const Range range = pending[next];
+				Range left, right;
+				if (range.count <= taskSize || !SplitTop(range, left, right)) {
+					top[next].task = (int32_t)tasks.size();
+					tasks.emplace_back();
+					tasks.back().range = range;
+					continue;
+				}
+				top[next].left = (uint32_t)top.size();
+				top[next].right = (uint32_t)top.size() + 1;
+				pending.push_back(left);
+				pending.push_back(right);
+				top.resize(top.size() + 2);
+			}
+
+			ForEach(tasks.size(), [&](size_t i) { BuildSubtree(tasks[i]); });
+			if (tasks.size() == 1) {
+				nodes.swap(tasks[0].nodes);
+				return;
+			}
+
+			nodes.resize(Place(top, tasks, 0, 0));
+			Node* out = nodes.begin();
+			for (const TopNode& node : top) {
+				if (node.task < 0) {
+					out[node.position].bounds = node.bounds;
+					out[node.position].offset = top[node.right].position;
+					out[node.position].count = 0;
+				}
+			}
+			ForEach(tasks.size(), [&](size_t i) {
+				const Task& task = tasks[i];
+				for (size_t k = 0; k < task.nodes.size(); ++k) {
+					Node node = task.nodes[k];
+					if (!node.isLeaf()) {
+						node.offset += task.base;
+					}
+					out[task.base + k] = node;
+				}
+			});
+		}
+
+	private:
+		struct TopNode {
+			uint32_t left = 0;
+			uint32_t right = 0;
+			// Subtree built by tasks[task], or -1 for an interior node.
+			int32_t task = -1;
+			uint32_t position = 0;
+			AABB bounds;
+		};
+
+		struct Task {
+			Range range;
+			FlatArray<Node> nodes;
+			uint32_t base = 0;
+		};
+
+		// Only the top of the tree may use the pool; tasks already run on it.
+		size_t BlockCount(uint32_t count, bool parallel) const {
+			return parallel && m_pool && count >= MIN_TASK_SIZE ? m_pool->Size() * BLOCKS_PER_WORKER : 1;
+		}
+
+		// Runs fn(block, begin, end) over BlockCount() even slices of [first, first + count).
+		template <typename Fn>
+		void ForBlocks(uint32_t first, uint32_t count, bool parallel, Fn&& fn) const {
+			const size_t blocks = BlockCount(count, parallel);
+			auto slice = [&](size_t b, size_t) {
+				fn(b, first + (uint32_t)((uint64_t)count * b / blocks), first + (uint32_t)((uint64_t)count * (b + 1) / blocks));
+			};
+			if (blocks == 1) {
+				slice(0, 0);
+			}
+			else {
+				m_pool->ParallelFor(blocks, slice);
+			}
+		}
+
+		template <typename Fn>
+		void ForEach(size_t count, Fn&& fn) const {
+			if (m_pool) {
+				m_pool->ParallelFor(count, [&](size_t i, size_t) { fn(i); });
+			}
+			else {
+				for (size_t i = 0; i < count; ++i) {
+					fn(i);
+				}
+			}
+		}
+
+		Range Measure(uint32_t first, uint32_t count, int depth, bool parallel) const {
+			std::vector<Range> partial(BlockCount(count, parallel));
+			ForBlocks(first, count, parallel, [&](size_t b, uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; ++i) {
+					partial[b].box.Grow(m_bounds[m_indices[i]]);
+					partial[b].centerBox.Grow(m_centers[m_indices[i]]);
+				}
+			});
+			Range range;
+			range.first = first;
+			range.count = count;
+			range.depth = depth;
+			for (const Range& p : partial) {
+				range.box.Grow(p.box);
+				range.centerBox.Grow(p.centerBox);
+			}
+			return range;
+		}
+
+		// Sorts the whole index array by Morton code, with a stable LSD radix sort of keys that
+		// pack the code above the primitive. Per-block histograms are summed digit-major,
+		// block-minor, so each block scatters behind the ones before it.
+		void RadixSort(const AABB& centerBox) {
+			const uint32_t n = (uint32_t)m_bounds.size();
+			std::vector<uint64_t> keys(n), sorted(n);
+			ForBlocks(0, n, true, [&](size_t, uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; ++i) {
+					keys[i] = (uint64_t)MortonCode(m_centers[i], centerBox) << 32 | i;
+				}
+			});
+
+			std::vector<uint32_t> offsets(BlockCount(n, true) * RADIX_SIZE);
+			const size_t blocks = offsets.size() / RADIX_SIZE;
+			uint64_t* from = keys.data();
+			uint64_t* to = sorted.data();
+			for (int shift = 32; shift < 32 + 3 * MORTON_BITS; shift += RADIX_BITS) {
+				std::fill(offsets.begin(), offsets.end(), 0);
+				ForBlocks(0, n, true, [&](size_t b, uint32_t begin, uint32_t end) {
+					uint32_t* histogram = &offsets[b * RADIX_SIZE];
+					for (uint32_t i = begin; i < end; ++i) {
+						++histogram[(from[i] >> shift) & (RADIX_SIZE - 1)];
+					}
+				});
+				uint32_t sum = 0;
+				for (uint32_t digit = 0; digit < RADIX_SIZE; ++digit) {
+					for (size_t b = 0; b < blocks; ++b) {
+						const uint32_t count = offsets[b * RADIX_SIZE + digit];
+						offsets[b * RADIX_SIZE + digit] = sum;
+						sum += count;
+					}
+				}
+				ForBlocks(0, n, true, [&](size_t b, uint32_t begin, uint32_t end) {
+					uint32_t* offset = &offsets[b * RADIX_SIZE];
+					for (uint32_t i = begin; i < end; ++i) {
+						to[offset[(from[i] >> shift) & (RADIX_SIZE - 1)]++] = from[i];
+					}
+				});
+				std::swap(from, to);
+			}
+
+			ForBlocks(0, n, true, [&](size_t, uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; ++i) {
+					m_indices[i] = (uint32_t)from[i];
+					m_codes[i] = (uint32_t)(from[i] >> 32);
+				}
+			});
+		}
+
+		// Orders a Balanced build's cluster along a Morton curve over its own centers.
+		void SortCluster(const Range& r) {
+			std::vector<uint64_t> keys(r.count);
+			for (uint32_t k = 0; k < r.count; ++k) {
+				const uint32_t prim = m_indices[r.first + k];
+				keys[k] = (uint64_t)MortonCode(m_centers[prim], r.centerBox) << 32 | prim;
+			}
+			std::sort(keys.begin(), keys.end());
+			for (uint32_t k = 0; k < r.count; ++k) {
+				m_indices[r.first + k] = (uint32_t)keys[k];
+				m_codes[r.first + k] = (uint32_t)(keys[k] >> 32);
+			}
+		}
+
+		bool SplitTop(const Range& r, Range& left, Range& right) {
+			if (m_quality != BuildQuality::Fast) {
+				return Split(r, left, right, true);
+			}
+			const uint32_t mid = LbvhSplit(r.first, r.count, r.depth);
+			left.first = r.first;
+			left.count = mid - r.first;
+			right.first = mid;
+			right.count = r.first + r.count - mid;
+			left.depth = right.depth = r.depth + 1;
+			return true;
+		}
+
+		void BuildSubtree(Task& task) {
+			task.nodes.reserve(task.range.count);
+			task.nodes.emplace_back();
+			if (m_quality == BuildQuality::Fast) {
+				BuildLbvh(task.nodes, 0, task.range.first, task.range.count, task.range.depth);
+			}
+			else {
+				BuildSah(task.nodes, 0, task.range);
+			}
+		}
+
+		void BuildSah(FlatArray<Node>& nodes, uint32_t nodeIndex, const Range& r) {
+			if (m_quality == BuildQuality::Balanced && r.count <= LBVH_CLUSTER_SIZE) {
+				SortCluster(r);
+				BuildLbvh(nodes, nodeIndex, r.first, r.count, r.depth);
+				return;
+			}
+
+			nodes[nodeIndex].bounds = r.box;
+			Range left, right;
+			if (r.count == 1 || !Split(r, left, right, false)) {
+				nodes[nodeIndex].offset = r.first;
+				nodes[nodeIndex].count = r.count;
+				return;
+			}
+
+			const uint32_t leftIndex = (uint32_t)nodes.size();
+			nodes.emplace_back();
+			BuildSah(nodes, leftIndex, left);
+
+			const uint32_t rightIndex = (uint32_t)nodes.size();
+			nodes.emplace_back();
+			BuildSah(nodes, rightIndex, right);
+
+			nodes[nodeIndex].offset = rightIndex;
+			nodes[nodeIndex].count = 0;
+		}
+
+		// Bounds come bottom-up, since Morton order alone does not give them.
+		void BuildLbvh(FlatArray<Node>& nodes, uint32_t nodeIndex, uint32_t first, uint32_t count, int depth) {
+			if (count <= MAX_LEAF_SIZE) {
+				AABB box;
+				for (uint32_t i = first; i < first + count; ++i) {
+					box.Grow(m_bounds[m_indices[i]]);
+				}
+				nodes[nodeIndex].bounds = box;
+				nodes[nodeIndex].offset = first;
+				nodes[nodeIndex].count = count;
+				return;
+			}
+
+			const uint32_t mid = LbvhSplit(first, count, depth);
+			const uint32_t leftIndex = (uint32_t)nodes.size();
+			nodes.emplace_back();
+			BuildLbvh(nodes, leftIndex, first, mid - first, depth + 1);
+
+			const uint32_t rightIndex = (uint32_t)nodes.size();
+			nodes.emplace_back();
+			BuildLbvh(nodes, rightIndex, mid, first + count - mid, depth + 1);
+
+			AABB box = nodes[leftIndex].bounds;
+			box.Grow(nodes[rightIndex].bounds);
+			nodes[nodeIndex].bounds = box;
+			nodes[nodeIndex].offset = rightIndex;
+			nodes[nodeIndex].count = 0;
+		}
+
+		// Splits a Morton-sorted run at its highest differing code bit, or in the middle when
+		// the codes are all equal or the tree is getting too deep.
+		uint32_t LbvhSplit(uint32_t first, uint32_t count, int depth) const {
+			const uint32_t* codes = m_codes.data();
+			const uint32_t lo = codes[first];
+			const uint32_t hi = codes[first + count - 1];
+			if (depth >= SAH_DEPTH_LIMIT || lo == hi) {
+				return first + count / 2;
+			}
+			const uint32_t bit = 1u << (std::bit_width(lo ^ hi) - 1);
+			return (uint32_t)(std::partition_point(codes + first, codes + first + count,
+				[&](uint32_t code) { return !(code & bit); }) - codes);
+		}
+
+		// Splits by SAH, or at the object median when SAH finds nothing usable. False when
+		// `r` is better off as a leaf.
+		bool Split(const Range& r, Range& left, Range& right, bool parallel) {
+			if (r.depth < SAH_DEPTH_LIMIT) {
+				Bins bins;
+				Bin(r, bins, parallel);
+				int axis = 0;
+				int split = 0;
+				double cost = 0.0;
+				if (FindSahSplit(bins, r, axis, split, cost)) {
+					const double leafCost = r.count * r.box.SurfaceArea();
+					if (r.count <= MAX_LEAF_SIZE && cost >= leafCost) {
+						return false;
+					}
+					Partition(r, axis, split, left, right, parallel);
+					if (left.count > 0 && right.count > 0) {
+						return true;
+					}
+				}
+			}
+
+			if (r.count <= MAX_LEAF_SIZE) {
+				return false;
+			}
+			// Cut at the object median along the widest axis.
+			const int axis = r.centerBox.LongestAxis();
+			const uint32_t mid = r.first + r.count / 2;
+			std::nth_element(m_indices + r.first, m_indices + mid, m_indices + r.first + r.count,
+				[&](uint32_t a, uint32_t b) { return m_centers[a][axis] < m_centers[b][axis]; });
+			left = Measure(r.first, mid - r.first, r.depth + 1, parallel);
+			right = Measure(mid, r.first + r.count - mid, r.depth + 1, parallel);
+			return true;
+		}
+
+		// Bins along all three axes in one pass over the primitives.
+		void Bin(const Range& r, Bins& bins, bool parallel) const {
+			double lo[3], scale[3];
+			for (int axis = 0; axis < 3; ++axis) {
+				const double extent = r.centerBox.max[axis] - r.centerBox.min[axis];
+				lo[axis] = r.centerBox.min[axis];
+				scale[axis] = extent > 0.0 ? BIN_COUNT / extent : 0.0;
+			}
+			auto fill = [&](Bins& out, uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; ++i) {
+					const uint32_t prim = m_indices[i];
+					for (int axis = 0; axis < 3; ++axis) {
+						const int bin = BinIndex(m_centers[prim][axis], lo[axis], scale[axis]);
+						out.bounds[axis][bin].Grow(m_bounds[prim]);
+						++out.counts[axis][bin];
+					}
+				}
+			};
+
+			const size_t blocks = BlockCount(r.count, parallel);
+			if (blocks == 1) {
+				fill(bins, r.first, r.first + r.count);
+				return;
+			}
+			std::vector<Bins> partial(blocks);
+			ForBlocks(r.first, r.count, parallel, [&](size_t b, uint32_t begin, uint32_t end) { fill(partial[b], begin, end); });
+			for (const Bins& p : partial) {
+				for (int axis = 0; axis < 3; ++axis) {
+					for (int bin = 0; bin < BIN_COUNT; ++bin) {
+						bins.bounds[axis][bin].Grow(p.bounds[axis][bin]);
+						bins.counts[axis][bin] += p.counts[axis][bin];
+					}
+				}
+			}
+		}
+
+		// Cost is expressed in the same units as count * SurfaceArea() of the parent.
+		static bool FindSahSplit(const Bins& bins, const Range& r, int& bestAxis, int& bestSplit, double& bestCost) {
+			bestCost = std::numeric_limits<double>::infinity();
+			bestAxis = -1;
+
+			for (int axis = 0; axis < 3; ++axis) {
+				if (!(r.centerBox.max[axis] - r.centerBox.min[axis] > 0.0)) {
+					continue;
+				}
+
+				// Sweep from the right to get the cost of every right-hand side, then from the left.
+				double rightArea[BIN_COUNT];
+				uint32_t rightCount[BIN_COUNT];
+				AABB acc;
+				uint32_t n = 0;
+				for (int b = BIN_COUNT - 1; b > 0; --b) {
+					acc.Grow(bins.bounds[axis][b]);
+					n += bins.counts[axis][b];
+					rightArea[b] = acc.SurfaceArea();
+					rightCount[b] = n;
+				}
+
+				acc = AABB();
+				n = 0;
+				for (int b = 1; b < BIN_COUNT; ++b) {
+					acc.Grow(bins.bounds[axis][b - 1]);
+					n += bins.counts[axis][b - 1];
+					if (n == 0 || rightCount[b] == 0) {
+						continue;
+					}
+					const double cost = n * acc.SurfaceArea() + rightCount[b] * rightArea[b];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = b;
+					}
+				}
+			}
+
+			if (bestAxis < 0) {
+				return false;
+			}
+
+			bestCost += TRAVERSAL_COST * r.box.SurfaceArea();
+			return true;
+		}
+
+		// Stable partition by bin. The serial path keeps lefts in place and parks rights in the
+		// scratch array; the shared one counts per block first and scatters everything there.
+		void Partition(const Range& r, int axis, int split, Range& left, Range& right, bool parallel) {
+			const double lo = r.centerBox.min[axis];
+			const double scale = BIN_COUNT / (r.centerBox.max[axis] - lo);
+			auto goesLeft = [&](uint32_t prim) { return BinIndex(m_centers[prim][axis], lo, scale) < split; };
+			left.depth = right.depth = r.depth + 1;
+			left.first = r.first;
+
+			const size_t blocks = BlockCount(r.count, parallel);
+			if (blocks == 1) {
+				uint32_t* lefts = m_indices + r.first;
+				uint32_t* rights = m_scratch.data() + r.first;
+				for (uint32_t i = r.first; i < r.first + r.count; ++i) {
+					const uint32_t prim = m_indices[i];
+					if (goesLeft(prim)) {
+						left.box.Grow(m_bounds[prim]);
+						left.centerBox.Grow(m_centers[prim]);
+						*lefts++ = prim;
+					}
+					else {
+						right.box.Grow(m_bounds[prim]);
+						right.centerBox.Grow(m_centers[prim]);
+						*rights++ = prim;
+					}
+				}
+				left.count = (uint32_t)(lefts - (m_indices + r.first));
+				right.first = r.first + left.count;
+				right.count = r.count - left.count;
+				std::copy(m_scratch.data() + r.first, rights, lefts);
+				return;
+			}
+
+			std::vector<Range> lefts(blocks), rights(blocks);
+			ForBlocks(r.first, r.count, parallel, [&](size_t b, uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; ++i) {
+					const uint32_t prim = m_indices[i];
+					Range& side = goesLeft(prim) ? lefts[b] : rights[b];
+					side.box.Grow(m_bounds[prim]);
+					side.centerBox.Grow(m_centers[prim]);
+					++side.count;
+				}
+			});
+			uint32_t leftCount = 0;
+			for (Range& p : lefts) {
+				p.first = r.first + leftCount;
+				leftCount += p.count;
+				left.box.Grow(p.box);
+				left.centerBox.Grow(p.centerBox);
+			}
+			uint32_t rightCount = 0;
+			for (Range& p : rights) {
+				p.first = r.first + leftCount + rightCount;
+				rightCount += p.count;
+				right.box.Grow(p.box);
+				right.centerBox.Grow(p.centerBox);
+			}
+			ForBlocks(r.first, r.count, parallel, [&](size_t b, uint32_t begin, uint32_t end) {
+				uint32_t l = lefts[b].first, rr = rights[b].first;
+				for (uint32_t i = begin; i < end; ++i) {
+					const uint32_t prim = m_indices[i];
+					m_scratch[goesLeft(prim) ? l++ : rr++] = prim;
+				}
+			});
+			ForBlocks(r.first, r.count, parallel, [&](size_t, uint32_t begin, uint32_t end) {
+				std::copy(m_scratch.data() + begin, m_scratch.data() + end, m_indices + begin);
+			});
+			left.count = leftCount;
+			right.first = r.first + leftCount;
+			right.count = rightCount;
+		}
+
+		// Lays the top nodes out depth-first from `position`, each task's subtree in place of
+		// its root, and returns the position past them.
+		static uint32_t Place(std::vector<TopNode>& top, std::vector<Task>& tasks, uint32_t index, uint32_t position) {
+			TopNode& node = top[index];
+			node.position = position;
+			if (node.task >= 0) {
+				Task& task = tasks[node.task];
+				task.base = position;
+				node.bounds = task.nodes[0].bounds;
+				return position + (uint32_t)task.nodes.size();
+			}
+			const uint32_t end = Place(top, tasks, node.right, Place(top, tasks, node.left, position + 1));
+			node.bounds = top[node.left].bounds;
+			node.bounds.Grow(top[node.right].bounds);
+			return end;
+		}
+
+		const std::vector<AABB>& m_bounds;
+		const BuildQuality m_quality;
+		// Null when building on the calling thread alone.
+		ThreadPool* m_pool;
+		uint32_t* m_indices;
+		std::vector<Point> m_centers;
+		// Morton code of the primitive at each position of the index array, for Fast and
+		// Balanced builds; in Balanced ones only clusters get codes.
+		std::vector<uint32_t> m_codes;
+		std::vector<uint32_t> m_scratch;
+	};
+
+private:
+	FlatArray<Node> m_nodes;
+	FlatArray<uint32_t> m_indices;
+	// Update state, empty until EnableUpdates().
+	std::vector<uint32_t> m_parents;
+	std::vector<uint32_t> m_leafOf;
+	std::vector<uint8_t> m_dirty;
+	std::vector<uint32_t> m_dirtyNodes;
+	// Unnormalised SAH cost behind Cost().
+	double m_cost;
+};
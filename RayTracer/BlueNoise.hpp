@@ -0,0 +1,135 @@
+#pragma once
+
+#include "Random.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Tileable blue-noise texture of ranks 0 .. SIZE^2 - 1, made with Ulichney's void-and-cluster
+// method. Thresholding it at any level gives evenly spread points without low-frequency clumps.
+class BlueNoise {
+public:
+	static constexpr uint32_t SIZE = 64;
+
+	// Generated once on first use; takes a few tens of milliseconds.
+	static const BlueNoise& Get() {
+		static const BlueNoise texture;
+		return texture;
+	}
+
+	// Value in (0, 1) at (x, y), wrapping around the edges.
+	double At(uint32_t x, uint32_t y) const {
+		return (m_rank[(y % SIZE) * SIZE + x % SIZE] + 0.5) / COUNT;
+	}
+
+private:
+	static constexpr uint32_t COUNT = SIZE * SIZE;
+	static constexpr double SIGMA = 1.5;
+
+	BlueNoise() : m_rank(COUNT) {
+		Generate();
+	}
+
+	void Generate() {
+		// Gaussian energy filter over toroidal distances.
+		std::vector<double> kernel(COUNT);
+		for (uint32_t y = 0; y < SIZE; ++y) {
+			for (uint32_t x = 0; x < SIZE; ++x) {
+				const double dx = std::fmin(x, SIZE - x);
+				const double dy = std::fmin(y, SIZE - y);
+				kernel[y * SIZE + x] = std::exp(-(dx * dx + dy * dy) / (2.0 * SIGMA * SIGMA));
+			}
+		}
+
+		// Initial pattern: a tenth of the pixels set at random, then relaxed by moving the point
+		// in the tightest cluster to the largest void until that no longer changes anything
+		// (capped, in case ties ever make it cycle).
+		std::vector<uint8_t> bits(COUNT, 0);
+		std::vector<double> energy(COUNT, 0.0);
+		Rng rng(0x626c75656e6f6973ull);
+		uint32_t ones = 0;
+		while (ones < COUNT / 10) {
+			const uint32_t i = (uint32_t)(rng.Next() % COUNT);
+			if (!bits[i]) {
+				bits[i] = 1;
+				Splat(kernel, energy, i, 1.0);
+				++ones;
+			}
+		}
+		for (uint32_t pass = 0; pass < COUNT; ++pass) {
+			const uint32_t cluster = Extreme(bits, energy, 1, true);
+			bits[cluster] = 0;
+			Splat(kernel, energy, cluster, -1.0);
+			const uint32_t voidIndex = Extreme(bits, energy, 0, false);
+			bits[voidIndex] = 1;
+			Splat(kernel, energy, voidIndex, 1.0);
+			if (voidIndex == cluster) {
+				break;
+			}
+		}
+		const std::vector<uint8_t> prototype = bits;
+		const std::vector<double> prototypeEnergy = energy;
+
+		// Ranks below the prototype: strip points from the tightest clusters.
+		for (uint32_t rank = ones; rank-- > 0;) {
+			const uint32_t cluster = Extreme(bits, energy, 1, true);
+			bits[cluster] = 0;
+			Splat(kernel, energy, cluster, -1.0);
+			m_rank[cluster] = (uint16_t)rank;
+		}
+
+		// Up to half full: fill the largest voids.
+		bits = prototype;
+		energy = prototypeEnergy;
+		for (uint32_t rank = ones; rank < COUNT / 2; ++rank) {
+			const uint32_t voidIndex = Extreme(bits, energy, 0, false);
+			bits[voidIndex] = 1;
+			Splat(kernel, energy, voidIndex, 1.0);
+			m_rank[voidIndex] = (uint16_t)rank;
+		}
+
+		// Past half the zeros are the minority, so switch to their energy and fill their tightest clusters.
+		std::fill(energy.begin(), energy.end(), 0.0);
+		for (uint32_t i = 0; i < COUNT; ++i) {
+			if (!bits[i]) {
+				Splat(kernel, energy, i, 1.0);
+			}
+		}
+		for (uint32_t rank = COUNT / 2; rank < COUNT; ++rank) {
+			const uint32_t cluster = Extreme(bits, energy, 0, true);
+			bits[cluster] = 1;
+			Splat(kernel, energy, cluster, -1.0);
+			m_rank[cluster] = (uint16_t)rank;
+		}
+	}
+
+	// Adds `sign` times the filter centred on pixel i.
+	static void Splat(const std::vector<double>& kernel, std::vector<double>& energy, uint32_t i, double sign) {
+		const uint32_t cx = i % SIZE, cy = i / SIZE;
+		for (uint32_t y = 0; y < SIZE; ++y) {
+			const double* row = &kernel[((y - cy) % SIZE) * SIZE];
+			double* out = &energy[y * SIZE];
+			for (uint32_t x = 0; x < SIZE; ++x) {
+				out[x] += sign * row[(x - cx) % SIZE];
+			}
+		}
+	}
+
+	// Highest (or lowest) energy among pixels whose bit equals `value`.
+	static uint32_t Extreme(const std::vector<uint8_t>& bits, const std::vector<double>& energy, uint8_t value, bool highest) {
+		uint32_t best = 0;
+		double bestEnergy = highest ? -INFINITY : INFINITY;
+		for (uint32_t i = 0; i < COUNT; ++i) {
+			if (bits[i] == value && (highest ? energy[i] > bestEnergy : energy[i] < bestEnergy)) {
+				best = i;
+				bestEnergy = energy[i];
+			}
+		}
+		return best;
+	}
+
+private:
+	std::vector<uint16_t> m_rank;
+};
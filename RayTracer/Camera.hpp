@@ -1,19 +1,23 @@
 #pragma once
 
 #include "Ray.hpp"
+#include "Utils.hpp"
 
-class Camera {
+template <typename T>
+class CameraT {
 public:
-	Camera(const size_t width, const size_t height, double v_fov,
-		Point lookfrom, Point lookat, Vec3 up, double focus_dist, double aperture) :
+	typedef Vec3T<T> Vec;
+
+	CameraT(const size_t width, const size_t height, T v_fov,
+		Vec lookfrom, Vec lookat, Vec up, T focus_dist, T aperture) :
 		m_vertical(), m_horizontal(), m_lowerleft(),
 		m_u(), m_v(), m_w(), m_lensRadius(aperture/2)
 	{
-		const auto aspectRatio = (double)width / height;
-		const auto theta = degrees_to_radians(v_fov);
-		const auto h = tan(theta / 2);
+		const auto aspectRatio = (T)width / height;
+		const auto theta = (T)degrees_to_radians(v_fov);
+		const auto h = std::tan(theta / 2);
 
-		const auto viewportHeight = 2.0 * h;
+		const auto viewportHeight = 2 * h;
 		const auto viewportWidth = aspectRatio * viewportHeight;
 
 		m_w = (lookfrom - lookat).unit();
@@ -27,21 +31,29 @@ public:
 		m_lowerleft = m_origin - m_horizontal / 2 - m_vertical / 2 - focus_dist*m_w;
 	}
 
-	Ray RayTo(double u, double v) const {
-		Vec3 rd = m_lensRadius * rand_point_in_unit_disk();
-		Vec3 offset = m_u * rd.x + m_v * rd.y;
+	RayT<T> RayTo(T u, T v) const {
+		const double lensU1 = random_double();
+		return RayTo(u, v, lensU1, random_double());
+	}
+
+	// (lensU1, lensU2) pick the point on the lens.
+	RayT<T> RayTo(T u, T v, double lensU1, double lensU2) const {
+		Vec rd = m_lensRadius * Vec(sample_concentric_disk(lensU1, lensU2));
+		Vec offset = m_u * rd.x + m_v * rd.y;
 
-		return Ray(m_origin + offset, u*m_horizontal + v*m_vertical + m_lowerleft - m_origin - offset);
+		return RayT<T>(m_origin + offset, u*m_horizontal + v*m_vertical + m_lowerleft - m_origin - offset);
 	}
 
 private:
 	
-	Vec3 m_origin;
-	Vec3 m_vertical;
-	Vec3 m_horizontal;
-	Vec3 m_lowerleft;
-
-	Vec3 m_u, m_v, m_w;
-	double m_aspectRatio;
-	double m_lensRadius;
-};
\ No newline at end of file
+	Vec m_origin;
+	Vec m_vertical;
+	Vec m_horizontal;
+	Vec m_lowerleft;
+
+	Vec m_u, m_v, m_w;
+	T m_aspectRatio;
+	T m_lensRadius;
+};
+
+typedef CameraT<double> Camera;
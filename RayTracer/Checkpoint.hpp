@@ -0,0 +1,119 @@
+#pragma once
+
+#include "AtomicFile.hpp"
+#include "Framebuffer.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+
+// Everything a render's pixels depend on, with a scene file reduced to its hash. A checkpoint
+// is only resumed by a render with identical settings. Laid out without padding so it can be
+// written as is.
+struct RenderSettings {
+	uint64_t width = 0;
+	uint64_t height = 0;
+	uint64_t seed = 0;
+	// Content hash of the scene file, 0 for the built-in scenes.
+	uint64_t sceneHash = 0;
+	double targetError = 0.0;
+	uint32_t scene = 0;
+	uint32_t sampler = 0;
+	uint32_t nextEventEstimation = 0;
+	int32_t maxDepth = 0;
+	int32_t minSamples = 0;
+	int32_t maxSamples = 0;
+
+	bool operator==(const RenderSettings&) const = default;
+};
+
+// Periodic snapshot of a render in progress: the settings, how many samples per pixel have been
+// started, and the framebuffer. The samplers are keyed by pixel and sample index, so a pixel's
+// sample count is all the sampler position there is to save.
+class Checkpoint {
+public:
+	explicit Checkpoint(const std::string& path) : m_path(path), m_snapshot(0, 0), m_samplesDone(0), m_ok(true) { }
+
+	~Checkpoint() {
+		Wait();
+	}
+
+	Checkpoint(const Checkpoint&) = delete;
+	Checkpoint& operator=(const Checkpoint&) = delete;
+
+	const std::string& Path() const {
+		return m_path;
+	}
+
+	// Copies the state and writes it on a background thread while rendering carries on. The
+	// file replaces the previous checkpoint through AtomicFile, so a crash part way through
+	// leaves the previous checkpoint intact.
+	void SaveAsync(const RenderSettings& settings, uint32_t samplesDone, const Framebuffer& framebuffer) {
+		Wait();
+		m_settings = settings;
+		m_samplesDone = samplesDone;
+		m_snapshot = framebuffer;
+		m_writer = std::thread([this] { m_ok = Write(); });
+	}
+
+	// Blocks until the last SaveAsync() has finished; false if it failed.
+	bool Wait() {
+		if (m_writer.joinable()) {
+			m_writer.join();
+		}
+		return m_ok;
+	}
+
+	// Reads a checkpoint written with `expected` settings into `framebuffer`, which must already
+	// have the right size.
+	static bool Load(const std::string& path, const RenderSettings& expected, uint32_t& samplesDone,
+		Framebuffer& framebuffer, std::string& error) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			error = "cannot open file";
+			return false;
+		}
+		uint32_t magic = 0, version = 0;
+		RenderSettings settings;
+		file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+		file.read(reinterpret_cast<char*>(&version), sizeof(version));
+		file.read(reinterpret_cast<char*>(&settings), sizeof(settings));
+		file.read(reinterpret_cast<char*>(&samplesDone), sizeof(samplesDone));
+		if (!file || magic != MAGIC || version != VERSION) {
+			error = "not a checkpoint file";
+			return false;
+		}
+		if (!(settings == expected)) {
+			error = "it was written with different settings";
+			return false;
+		}
+		if (!framebuffer.Read(file)) {
+			error = "file is truncated";
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static constexpr uint32_t MAGIC = 0x4b435452; // "RTCK"
+	static constexpr uint32_t VERSION = 3;
+
+	bool Write() const {
+		AtomicFile file(m_path);
+		return file.Write(&MAGIC, sizeof(MAGIC))
+			&& file.Write(&VERSION, sizeof(VERSION))
+			&& file.Write(&m_settings, sizeof(m_settings))
+			&& file.Write(&m_samplesDone, sizeof(m_samplesDone))
+			&& m_snapshot.Write(file)
+			&& file.Commit();
+	}
+
+private:
+	std::string m_path;
+	RenderSettings m_settings;
+	Framebuffer m_snapshot;
+	uint32_t m_samplesDone;
+	bool m_ok;
+	std::thread m_writer;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Contiguous array of plain values that either owns them in a std::vector or views read-only
+// memory owned elsewhere, such as a memory-mapped scene cache. Reads go straight through a
+// pointer in both cases; the first mutation of a view copies it into owned storage.
+template <typename T>
+class FlatArray {
+	static_assert(std::is_trivially_copyable<T>::value, "FlatArray holds plain values only");
+
+public:
+	FlatArray() : m_owned(), m_data(nullptr), m_size(0), m_view(false) { }
+
+	FlatArray(const FlatArray& rhs) : m_owned(rhs.m_owned), m_data(rhs.m_data), m_size(rhs.m_size), m_view(rhs.m_view) {
+		Sync();
+	}
+
+	FlatArray(FlatArray&& rhs) noexcept : m_owned(std::move(rhs.m_owned)), m_data(rhs.m_data), m_size(rhs.m_size), m_view(rhs.m_view) {
+		Sync();
+		rhs.m_view = false;
+		rhs.Sync();
+	}
+
+	FlatArray& operator=(FlatArray rhs) noexcept {
+		swap(rhs);
+		return *this;
+	}
+
+	// Non-owning view of `size` values at `data`, which must outlive the array.
+	static FlatArray View(const T* data, size_t size) {
+		FlatArray array;
+		array.m_data = const_cast<T*>(data);
+		array.m_size = size;
+		array.m_view = true;
+		return array;
+	}
+
+	bool IsView() const {
+		return m_view;
+	}
+
+	size_t size() const {
+		return m_size;
+	}
+
+	bool empty() const {
+		return m_size == 0;
+	}
+
+	const T* data() const {
+		return m_data;
+	}
+
+	const T& operator[](size_t i) const {
+		return m_data[i];
+	}
+
+	T& operator[](size_t i) {
+		Own();
+		return m_data[i];
+	}
+
+	const T* begin() const {
+		return m_data;
+	}
+
+	const T* end() const {
+		return m_data + m_size;
+	}
+
+	T* begin() {
+		Own();
+		return m_data;
+	}
+
+	T* end() {
+		Own();
+		return m_data + m_size;
+	}
+
+	void push_back(const T& value) {
+		Own();
+		m_owned.push_back(value);
+		Sync();
+	}
+
+	template <typename... Args>
+	T& emplace_back(Args&&... args) {
+		Own();
+		m_owned.emplace_back(std::forward<Args>(args)...);
+		Sync();
+		return m_owned.back();
+	}
+
+	void reserve(size_t count) {
+		Own();
+		m_owned.reserve(count);
+		Sync();
+	}
+
+	void resize(size_t count) {
+		Own();
+		m_owned.resize(count);
+		Sync();
+	}
+
+	void clear() {
+		m_view = false;
+		m_owned.clear();
+		Sync();
+	}
+
+	void swap(FlatArray& rhs) noexcept {
+		m_owned.swap(rhs.m_owned);
+		std::swap(m_data, rhs.m_data);
+		std::swap(m_size, rhs.m_size);
+		std::swap(m_view, rhs.m_view);
+		Sync();
+		rhs.Sync();
+	}
+
+private:
+	void Own() {
+		if (m_view) {
+			m_owned.assign(m_data, m_data + m_size);
+			m_view = false;
+			Sync();
+		}
+	}
+
+	// Points m_data at the vector again after it may have moved.
+	void Sync() {
+		if (!m_view) {
+			m_data = m_owned.data();
+			m_size = m_owned.size();
+		}
+	}
+
+private:
+	std::vector<T> m_owned;
+	T* m_data;
+	size_t m_size;
+	bool m_view;
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+#include "AtomicFile.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <vector>
+
+// Linear radiance accumulated per pixel as the sum of its samples and their count. Kept apart
+// from the 8-bit display image so a render can be continued, post-processed or saved as HDR.
+// Row 0 is the bottom of the image.
+class Framebuffer {
+public:
+	// Running mean and sum of squared deviations (Welford) of a pixel's sample luminance, kept
+	// for the adaptive sampling stop test.
+	struct Moments {
+		double mean = 0.0;
+		double m2 = 0.0;
+	};
+
+	Framebuffer(size_t width, size_t height) :
+		m_width(width), m_height(height), m_sum(width * height * 3, 0.0), m_count(width * height, 0),
+		m_moments(width * height) { }
+
+	size_t Width() const {
+		return m_width;
+	}
+
+	size_t Height() const {
+		return m_height;
+	}
+
+	// Pixels are only ever touched by the tile that owns them, so this needs no locking.
+	void Add(size_t x, size_t y, const Color& sum, uint32_t count) {
+		const size_t index = x + m_width * y;
+		m_sum[3 * index] += sum.r();
+		m_sum[3 * index + 1] += sum.g();
+		m_sum[3 * index + 2] += sum.b();
+		m_count[index] += count;
+	}
+
+	Color Mean(size_t x, size_t y) const {
+		const size_t index = x + m_width * y;
+		if (m_count[index] == 0) {
+			return Color(0.0, 0.0, 0.0);
+		}
+		const double scale = 1.0 / m_count[index];
+		return Color(m_sum[3 * index] * scale, m_sum[3 * index + 1] * scale, m_sum[3 * index + 2] * scale);
+	}
+
+	uint32_t Count(size_t x, size_t y) const {
+		return m_count[x + m_width * y];
+	}
+
+	Moments& LuminanceMoments(size_t x, size_t y) {
+		return m_moments[x + m_width * y];
+	}
+
+	const Moments& LuminanceMoments(size_t x, size_t y) const {
+		return m_moments[x + m_width * y];
+	}
+
+	void Clear() {
+		std::fill(m_sum.begin(), m_sum.end(), 0.0);
+		std::fill(m_count.begin(), m_count.end(), 0);
+		std::fill(m_moments.begin(), m_moments.end(), Moments());
+	}
+
+	// Raw accumulation state in host byte order, for checkpoints. Read() expects a stream
+	// written by a framebuffer of the same size.
+	bool Write(AtomicFile& out) const {
+		return out.Write(m_sum.data(), m_sum.size() * sizeof(double))
+			&& out.Write(m_count.data(), m_count.size() * sizeof(uint32_t))
+			&& out.Write(m_moments.data(), m_moments.size() * sizeof(Moments));
+	}
+
+	bool Read(std::istream& in) {
+		in.read(reinterpret_cast<char*>(m_sum.data()), m_sum.size() * sizeof(double));
+		in.read(reinterpret_cast<char*>(m_count.data()), m_count.size() * sizeof(uint32_t));
+		in.read(reinterpret_cast<char*>(m_moments.data()), m_moments.size() * sizeof(Moments));
+		return (bool)in;
+	}
+
+	// Display encode: the per-pixel mean, gamma 2 and clamped to 8 bits.
+	void Encode(std::vector<byte>& out) const {
+		out.resize(m_width * m_height * 3);
+		for (size_t y = 0; y < m_height; ++y) {
+			for (size_t x = 0; x < m_width; ++x) {
+				const Color mean = Mean(x, y);
+				const size_t index = (x + m_width * y) * 3;
+				out[index] = static_cast<byte>(clamp(sqrt(mean.r())) * BYTE_MAX);
+				out[index + 1] = static_cast<byte>(clamp(sqrt(mean.g())) * BYTE_MAX);
+				out[index + 2] = static_cast<byte>(clamp(sqrt(mean.b())) * BYTE_MAX);
+			}
+		}
+	}
+
+	// Portable float map of the linear means: little endian, bottom row first.
+	bool WritePFM(const char* path) const {
+		std::ofstream file(path, std::ios::binary);
+		if (!file) {
+			return false;
+		}
+		file << "PF\n" << m_width << ' ' << m_height << "\n-1.0\n";
+
+		std::vector<uint8_t> row(m_width * 3 * 4);
+		for (size_t y = 0; y < m_height; ++y) {
+			uint8_t* out = row.data();
+			for (size_t x = 0; x < m_width; ++x) {
+				const Color mean = Mean(x, y);
+				out = PutFloat(out, (float)mean.r());
+				out = PutFloat(out, (float)mean.g());
+				out = PutFloat(out, (float)mean.b());
+			}
+			file.write(reinterpret_cast<const char*>(row.data()), row.size());
+		}
+		return (bool)file;
+	}
+
+	// Minimal OpenEXR: single part, scanlines, no compression, 32-bit float B, G, R channels.
+	bool WriteEXR(const char* path) const {
+		std::vector<uint8_t> header;
+		auto put = [&header](const void* data, size_t size) {
+			const uint8_t* bytes = static_cast<const uint8_t*>(data);
+			header.insert(header.end(), bytes, bytes + size);
+		};
+		auto putInt = [&](uint32_t value) {
+			uint8_t bytes[4];
+			PutUint32(bytes, value);
+			put(bytes, 4);
+		};
+		auto attribute = [&](const char* name, const char* type, uint32_t size) {
+			put(name, strlen(name) + 1);
+			put(type, strlen(type) + 1);
+			putInt(size);
+		};
+
+		putInt(20000630); // Magic number
+		putInt(2);        // Version 2, single-part scanline file
+
+		// Channels must be listed in alphabetical order.
+		attribute("channels", "chlist", 3 * 18 + 1);
+		for (const char* channel : { "B", "G", "R" }) {
+			put(channel, 2);
+			putInt(2);    // FLOAT
+			putInt(0);    // pLinear and reserved bytes
+			putInt(1);    // x sampling
+			putInt(1);    // y sampling
+		}
+		put("", 1);
+
+		const uint8_t zero = 0;
+		attribute("compression", "compression", 1);
+		put(&zero, 1);  // NO_COMPRESSION
+		for (const char* window : { "dataWindow", "displayWindow" }) {
+			attribute(window, "box2i", 16);
+			putInt(0);
+			putInt(0);
+			putInt((uint32_t)m_width - 1);
+			putInt((uint32_t)m_height - 1);
+		}
+		attribute("lineOrder", "lineOrder", 1);
+		put(&zero, 1);  // INCREASING_Y
+		attribute("pixelAspectRatio", "float", 4);
+		putInt(FloatBits(1.0f));
+		attribute("screenWindowCenter", "v2f", 8);
+		putInt(FloatBits(0.0f));
+		putInt(FloatBits(0.0f));
+		attribute("screenWindowWidth", "float", 4);
+		putInt(FloatBits(1.0f));
+		put("", 1);
+
+		// Offset table, then one block per scanline: y, byte count, then each channel's row.
+		const size_t lineBytes = m_width * 3 * 4;
+		const uint64_t firstLine = header.size() + m_height * 8;
+		for (size_t y = 0; y < m_height; ++y) {
+			const uint64_t offset = firstLine + y * (8 + lineBytes);
+			putInt((uint32_t)offset);
+			putInt((uint32_t)(offset >> 32));
+		}
+
+		std::ofstream file(path, std::ios::binary);
+		if (!file) {
+			return false;
+		}
+		file.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+		std::vector<uint8_t> block(8 + lineBytes);
+		for (size_t line = 0; line < m_height; ++line) {
+			// EXR scanlines run top to bottom.
+			const size_t y = m_height - 1 - line;
+			PutUint32(block.data(), (uint32_t)line);
+			PutUint32(block.data() + 4, (uint32_t)lineBytes);
+			for (size_t x = 0; x < m_width; ++x) {
+				const Color mean = Mean(x, y);
+				PutFloat(block.data() + 8 + 4 * x, (float)mean.b());
+				PutFloat(block.data() + 8 + 4 * (m_width + x), (float)mean.g());
+				PutFloat(block.data() + 8 + 4 * (2 * m_width + x), (float)mean.r());
+			}
+			file.write(reinterpret_cast<const char*>(block.data()), block.size());
+		}
+		return (bool)file;
+	}
+
+private:
+	static uint32_t FloatBits(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	// Little endian whatever the host is.
+	static uint8_t* PutUint32(uint8_t* out, uint32_t value) {
+		out[0] = (uint8_t)value;
+		out[1] = (uint8_t)(value >> 8);
+		out[2] = (uint8_t)(value >> 16);
+		out[3] = (uint8_t)(value >> 24);
+		return out + 4;
+	}
+
+	static uint8_t* PutFloat(uint8_t* out, float value) {
+		return PutUint32(out, FloatBits(value));
+	}
+
+private:
+	size_t m_width;
+	size_t m_height;
+	// Double, so a pixel's sum keeps resolving single samples at high sample counts.
+	std::vector<double> m_sum;
+	std::vector<uint32_t> m_count;
+	std::vector<Moments> m_moments;
+};
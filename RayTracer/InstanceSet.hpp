@@ -0,0 +1,183 @@
+#pragma once
+
+#include "hittable.hpp"
+#include "BVH.hpp"
+#include "FlatArray.hpp"
+#include "Transform.hpp"
+#include "TriangleMesh.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Index of a shared object in an InstanceSet.
+typedef uint32_t ObjectId;
+
+// Meshes placed any number of times by affine transforms, under a top-level BVH over the
+// placements. An instance holds only its world-to-object transform and the object it shows,
+// so repeating a mesh costs about a hundred bytes rather than a copy of its triangles and BVH.
+// A ray is taken into an object's space only when the top level reaches one of its instances.
+class InstanceSet {
+public:
+	InstanceSet() : m_objects(), m_instances(), m_bvh() { }
+
+	// `mesh` must have been built.
+	ObjectId AddObject(std::shared_ptr<const TriangleMesh> mesh) {
+		m_objects.push_back(std::move(mesh));
+		return (ObjectId)(m_objects.size() - 1);
+	}
+
+	// Places `object` by `objectToWorld`; false if the transform cannot be inverted.
+	bool Add(ObjectId object, const Transform& objectToWorld) {
+		Instance instance;
+		if (!objectToWorld.Inverse(instance.worldToObject)) {
+			return false;
+		}
+		instance.object = object;
+		m_instances.push_back(instance);
+		m_bvh.Clear();
+		return true;
+	}
+
+	void Reserve(size_t count) {
+		m_instances.reserve(count);
+	}
+
+	// Builds the top-level BVH and stores the instances in its leaf order.
+	void Build(BVH::BuildQuality quality, ThreadPool* pool = nullptr) {
+		vector<AABB> bounds(m_instances.size());
+		ParallelSlices(pool, bounds.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				bounds[i] = InstanceBounds(m_instances[i]);
+			}
+		});
+		m_bvh.Build(bounds, quality, pool);
+
+		const FlatArray<uint32_t>& order = m_bvh.Indices();
+		const FlatArray<Instance>& instances = m_instances;
+		FlatArray<Instance> sorted;
+		sorted.resize(order.size());
+		Instance* out = sorted.begin();
+		ParallelSlices(pool, order.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				out[i] = instances[order[i]];
+			}
+		});
+		m_instances.swap(sorted);
+		m_bvh.ReleaseIndices();
+	}
+
+	void Clear() {
+		m_objects.clear();
+		m_instances.clear();
+		m_bvh.Clear();
+	}
+
+	bool Empty() const {
+		return m_instances.empty();
+	}
+
+	size_t Size() const {
+		return m_instances.size();
+	}
+
+	size_t ObjectCount() const {
+		return m_objects.size();
+	}
+
+	// Bytes of the placements and the top-level BVH.
+	size_t MemoryBytes() const {
+		return m_instances.size() * sizeof(Instance) + m_bvh.NodeCount() * sizeof(BVH::Node);
+	}
+
+	// Bytes of the objects themselves, each counted once however often it is placed.
+	size_t ObjectMemoryBytes() const {
+		size_t bytes = 0;
+		for (const auto& object : m_objects) {
+			bytes += object->MemoryBytes();
+		}
+		return bytes;
+	}
+
+	// On a hit `prim` holds the instance in its high 32 bits and the object's primitive in the low ones.
+	bool Intersect(const Ray& r, double tmin, double& closest, PrimId& prim) const {
+		return m_bvh.Traverse(r, tmin, closest, [&](uint32_t first, uint32_t count, double& t) {
+			bool hit = false;
+			for (uint32_t i = first; i < first + count; ++i) {
+				const LocalRay local(m_instances[i], r);
+				double localClosest = t * local.scale;
+				PrimId localPrim;
+				if (m_objects[m_instances[i].object]->Intersect(local.ray, tmin * local.scale, localClosest, localPrim)) {
+					t = localClosest / local.scale;
+					prim = (PrimId)i << 32 | localPrim;
+					hit = true;
+				}
+			}
+			return hit;
+		});
+	}
+
+	bool Occluded(const Ray& r, double tmin, double tmax) const {
+		return m_bvh.TraverseAny(r, tmin, tmax, [&](uint32_t first, uint32_t count) {
+			for (uint32_t i = first; i < first + count; ++i) {
+				const LocalRay local(m_instances[i], r);
+				if (m_objects[m_instances[i].object]->isOccluded(local.ray, tmin * local.scale, tmax * local.scale)) {
+					return true;
+				}
+			}
+			return false;
+		});
+	}
+
+	// The point comes from the world ray; the normal is taken back by the inverse transpose.
+	void FillHitRecord(const Ray& r, double t, PrimId prim, HitRecord& rec) const {
+		const Instance& instance = m_instances[(size_t)(prim >> 32)];
+		const LocalRay local(instance, r);
+		HitRecord localRec;
+		m_objects[instance.object]->FillHitRecord(local.ray, t * local.scale, prim & 0xffffffffu, localRec);
+		const Vec3 outward = localRec.isFrontFace ? localRec.normal : -localRec.normal;
+		rec.Set(r, t, instance.worldToObject.ApplyTransposed(outward).unit(), localRec.mat);
+	}
+
+	AABB Bounds() const {
+		if (!m_bvh.Empty()) {
+			return m_bvh.Bounds();
+		}
+		AABB box;
+		for (const Instance& instance : m_instances) {
+			box.Grow(InstanceBounds(instance));
+		}
+		return box;
+	}
+
+private:
+	struct Instance {
+		Transform worldToObject;
+		ObjectId object;
+	};
+
+	// A world ray taken into an instance's object space. Distances there are `scale` times the
+	// world ones, since the transform may scale.
+	struct LocalRay {
+		Ray ray;
+		double scale;
+
+		LocalRay(const Instance& instance, const Ray& r) {
+			const Vec3 direction = instance.worldToObject.ApplyVector(r.direction());
+			scale = direction.length();
+			ray = Ray(instance.worldToObject.ApplyPoint(r.origin()), direction);
+		}
+	};
+
+	AABB InstanceBounds(const Instance& instance) const {
+		Transform objectToWorld;
+		instance.worldToObject.Inverse(objectToWorld);
+		return objectToWorld.ApplyBox(m_objects[instance.object]->Bounds());
+	}
+
+private:
+	std::vector<std::shared_ptr<const TriangleMesh>> m_objects;
+	FlatArray<Instance> m_instances;
+	// Top level: its leaves are ranges of m_instances.
+	BVH m_bvh;
+};
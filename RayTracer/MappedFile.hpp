@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file. Pages are loaded on first touch, so opening even a
+// very large file costs next to nothing.
+class MappedFile {
+public:
+	MappedFile() : m_data(nullptr), m_size(0) { }
+
+	~MappedFile() {
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path) {
+		Close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER size;
+		HANDLE mapping = nullptr;
+		if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		}
+		CloseHandle(file);
+		if (!mapping) {
+			return false;
+		}
+		// The view keeps the mapping alive on its own.
+		m_data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+		if (!m_data) {
+			return false;
+		}
+		m_size = (size_t)size.QuadPart;
+#else
+		const int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat info;
+		void* data = MAP_FAILED;
+		if (fstat(fd, &info) == 0 && info.st_size > 0) {
+			data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		close(fd);
+		if (data == MAP_FAILED) {
+			return false;
+		}
+		m_data = static_cast<const uint8_t*>(data);
+		m_size = (size_t)info.st_size;
+#endif
+		return true;
+	}
+
+	void Close() {
+		if (!m_data) {
+			return;
+		}
+#ifdef _WIN32
+		UnmapViewOfFile(m_data);
+#else
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	const uint8_t* Data() const {
+		return m_data;
+	}
+
+	size_t Size() const {
+		return m_size;
+	}
+
+private:
+	const uint8_t* m_data;
+	size_t m_size;
+};
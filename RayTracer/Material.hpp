@@ -3,74 +3,176 @@
 #include "Utils.hpp"
 #include "Ray.hpp"
 #include "hittable.hpp"
+#include "Sampler.hpp"
 
+#include <cstdint>
 #include <memory>
+#include <variant>
 
+// One scattered direction drawn by a material. `weight` is f * |cos| / pdf, the factor the path
+// throughput is multiplied by. Specular lobes are deltas: `pdf` is 0 and Evaluate()/Pdf() never
+// see them, so only `weight` is meaningful.
+struct ScatterRecord {
+	Vec3 direction;
+	Color weight;
+	double pdf = 0.0;
+	bool isSpecular = false;
+};
+
+// Directions follow the usual convention: wo points back towards where the ray came from, wi
+// is the scattered direction, both unit length. Evaluate() returns f(wo, wi) * |cos(wi)| and
+// Pdf() the solid-angle density with which Sample() picks wi. Sample() may draw up to
+// BSDF_DIMENSIONS numbers from the sampler.
+//
+// Extension interface for materials outside the built-in set. These go through a virtual
+// call per bounce; the built-in materials below are dispatched by AnyMaterial instead.
 class Material {
 public:
-	virtual bool Scatter(const Ray& ray_in, const HitRecord & rec, Color& attenuation, Ray& ray_out) = 0;
+	static constexpr uint32_t BSDF_DIMENSIONS = 3;
+
+	virtual bool Sample(const HitRecord& rec, const Vec3& wo, Sampler& sampler, ScatterRecord& srec) = 0;
+	virtual Color Evaluate(const HitRecord& rec, const Vec3& wo, const Vec3& wi) = 0;
+	virtual double Pdf(const HitRecord& rec, const Vec3& wo, const Vec3& wi) = 0;
+
+	virtual Color Emitted(const HitRecord&) {
+		return Color(0.0, 0.0, 0.0);
+	}
 };
 
-class Lambertian final : public Material {
+typedef std::shared_ptr<Material> MaterialPtr;
+
+class Lambertian final {
 public:
 	Lambertian(const Color & albedo) : m_albedo(albedo) {}
 
-	virtual bool Scatter(const Ray& ray_in, const HitRecord& rec, Color& attenuation, Ray& ray_out) override {
-		auto scatter_dir = rec.normal + random_unit_vec();
-		if (scatter_dir.nearZero()) {
-			scatter_dir = rec.normal;
-		}
-		ray_out = Ray(rec.point, scatter_dir);
-		attenuation = m_albedo;
-		return true;
+	// Cosine-weighted, so the cosine and 1/pi of the BRDF cancel against the pdf.
+	bool Sample(const HitRecord& rec, const Vec3&, Sampler& sampler, ScatterRecord& srec) const {
+		double u1, u2;
+		sampler.Get2D(u1, u2);
+		srec.direction = to_frame(sample_cosine_hemisphere(u1, u2), rec.normal);
+		srec.pdf = cosine_hemisphere_pdf(dot(srec.direction, rec.normal));
+		srec.weight = m_albedo;
+		srec.isSpecular = false;
+		return srec.pdf > 0.0;
+	}
+
+	Color Evaluate(const HitRecord& rec, const Vec3&, const Vec3& wi) const {
+		return cosine_hemisphere_pdf(dot(wi, rec.normal)) * m_albedo;
+	}
+
+	double Pdf(const HitRecord& rec, const Vec3&, const Vec3& wi) const {
+		return cosine_hemisphere_pdf(dot(wi, rec.normal));
+	}
+
+	Color Emitted(const HitRecord&) const {
+		return Color(0.0, 0.0, 0.0);
+	}
+
+	const Color& Albedo() const {
+		return m_albedo;
 	}
 
 private:
 	Color m_albedo;
 };
 
-class Metal final : public Material {
+// Fuzzy mirror. Fuzz 0 is a perfect mirror; otherwise a cos^n lobe around the mirror direction,
+// with n = 2 / fuzz^2 - 2 so the lobe widens roughly like the old fuzz sphere did. Directions
+// that end up below the surface are absorbed.
+class Metal final {
 public:
-	Metal(const Color & albedo, float fuzz) : m_albedo(albedo), m_fuzz(fuzz < 1 ? fuzz : 1) {}
+	Metal(const Color & albedo, float fuzz) : m_albedo(albedo), m_fuzz(fuzz < 1 ? fuzz : 1),
+		m_exponent(m_fuzz > 0 ? 2.0 / ((double)m_fuzz * m_fuzz) - 2.0 : 0.0) {}
 
-	bool Scatter(const Ray & ray_in, const HitRecord & rec, Color & attenuation, Ray & ray_out) override {
-		Vec3 reflected = reflect(ray_in.direction(), rec.normal);
-		ray_out = Ray(rec.point, reflected + m_fuzz*rand_point_in_unit_s());
-		attenuation = m_albedo;
-		return dot(ray_out.direction(), rec.normal) > 0.0;
+	bool Sample(const HitRecord& rec, const Vec3& wo, Sampler& sampler, ScatterRecord& srec) const {
+		const Vec3 reflected = reflect(-wo, rec.normal);
+		double u1, u2;
+		sampler.Get2D(u1, u2);
+		if (m_fuzz <= 0) {
+			srec.direction = reflected;
+			srec.pdf = 0.0;
+			srec.isSpecular = true;
+		}
+		else {
+			srec.direction = to_frame(sample_power_cosine(u1, u2, m_exponent), reflected);
+			srec.pdf = power_cosine_pdf(dot(srec.direction, reflected), m_exponent);
+			srec.isSpecular = false;
+		}
+		srec.weight = m_albedo;
+		return dot(srec.direction, rec.normal) > 0.0;
+	}
+
+	Color Evaluate(const HitRecord& rec, const Vec3& wo, const Vec3& wi) const {
+		return Pdf(rec, wo, wi) * m_albedo;
+	}
+
+	double Pdf(const HitRecord& rec, const Vec3& wo, const Vec3& wi) const {
+		if (m_fuzz <= 0 || dot(wi, rec.normal) <= 0.0) {
+			return 0.0;
+		}
+		return power_cosine_pdf(dot(wi, reflect(-wo, rec.normal)), m_exponent);
+	}
+
+	Color Emitted(const HitRecord&) const {
+		return Color(0.0, 0.0, 0.0);
+	}
+
+	const Color& Albedo() const {
+		return m_albedo;
+	}
+
+	float Fuzz() const {
+		return m_fuzz;
 	}
 
 private:
 	Color m_albedo;
 
 	float m_fuzz;
+	double m_exponent;
 };
 
-class Dielectric : public Material {
+class Dielectric final {
 public:
 	Dielectric(double ir) : m_ir(ir) {}
 
-	bool Scatter(const Ray & ray, const HitRecord & record, Color & attenuation, Ray & ray_out) override {
-		attenuation = Color(1.0, 1.0, 1.0);
+	bool Sample(const HitRecord& record, const Vec3& wo, Sampler& sampler, ScatterRecord& srec) const {
 		double ir = record.isFrontFace ? (1.0 / m_ir) : m_ir;
-		auto r_dir = ray.direction().unit();
+		const Vec3 r_dir = -wo;
 
-		auto cthetha = fmin(dot(-r_dir, record.normal.unit()), 1.0);
+		auto cthetha = fmin(dot(wo, record.normal), 1.0);
 		auto sthetha = sqrt(1.0 - cthetha * cthetha);
 
-		Vec3 direction;
 		bool cannot_refract = sthetha * ir > 1.0;
-		if (cannot_refract || reflectance(cthetha, ir) > random_double()) {
-			direction = reflect(r_dir, record.normal);
+		if (cannot_refract || reflectance(cthetha, ir) > sampler.Get1D()) {
+			srec.direction = reflect(r_dir, record.normal);
 		}
 		else {
-			direction = refract(r_dir, record.normal, ir);
+			srec.direction = refract(r_dir, record.normal, ir);
 		}
 
-		ray_out = Ray(record.point, direction);
+		srec.weight = Color(1.0, 1.0, 1.0);
+		srec.pdf = 0.0;
+		srec.isSpecular = true;
 		return true;
 	}
 
+	Color Evaluate(const HitRecord&, const Vec3&, const Vec3&) const {
+		return Color(0.0, 0.0, 0.0);
+	}
+
+	double Pdf(const HitRecord&, const Vec3&, const Vec3&) const {
+		return 0.0;
+	}
+
+	Color Emitted(const HitRecord&) const {
+		return Color(0.0, 0.0, 0.0);
+	}
+
+	double IndexOfRefraction() const {
+		return m_ir;
+	}
+
 private:
 	double m_ir;
 
@@ -81,4 +183,104 @@ private:
 	}
 };
 
-typedef std::shared_ptr<Material> MaterialPtr;
\ No newline at end of file
+// Emits m_emit from its front face and absorbs everything that arrives. World samples
+// objects made of it directly (next-event estimation) in addition to hitting them by chance.
+class DiffuseLight final {
+public:
+	DiffuseLight(const Color & emit) : m_emit(emit) {}
+
+	bool Sample(const HitRecord&, const Vec3&, Sampler&, ScatterRecord&) const {
+		return false;
+	}
+
+	Color Evaluate(const HitRecord&, const Vec3&, const Vec3&) const {
+		return Color(0.0, 0.0, 0.0);
+	}
+
+	double Pdf(const HitRecord&, const Vec3&, const Vec3&) const {
+		return 0.0;
+	}
+
+	Color Emitted(const HitRecord& rec) const {
+		return rec.isFrontFace ? m_emit : Color(0.0, 0.0, 0.0);
+	}
+
+	const Color& Emit() const {
+		return m_emit;
+	}
+
+private:
+	Color m_emit;
+};
+
+// Order matches the alternatives of AnyMaterial.
+enum class MaterialType : uint8_t {
+	Lambertian,
+	Metal,
+	Dielectric,
+	DiffuseLight,
+	Custom,
+	Count
+};
+
+// Closed tagged union over the built-in materials. Every call switches on the tag, so the
+// compiler sees every implementation and can inline it; only Custom pays for a virtual call.
+class AnyMaterial {
+public:
+	AnyMaterial(const Lambertian& material) : m_value(material) { }
+	AnyMaterial(const Metal& material) : m_value(material) { }
+	AnyMaterial(const Dielectric& material) : m_value(material) { }
+	AnyMaterial(const DiffuseLight& material) : m_value(material) { }
+	AnyMaterial(MaterialPtr material) : m_value(material) { }
+
+	MaterialType Type() const {
+		return static_cast<MaterialType>(m_value.index());
+	}
+
+	bool Sample(const HitRecord& rec, const Vec3& wo, Sampler& sampler, ScatterRecord& srec) const {
+		return Visit<bool>([&](auto& material) { return material.Sample(rec, wo, sampler, srec); });
+	}
+
+	Color Evaluate(const HitRecord& rec, const Vec3& wo, const Vec3& wi) const {
+		return Visit<Color>([&](auto& material) { return material.Evaluate(rec, wo, wi); });
+	}
+
+	double Pdf(const HitRecord& rec, const Vec3& wo, const Vec3& wi) const {
+		return Visit<double>([&](auto& material) { return material.Pdf(rec, wo, wi); });
+	}
+
+	Color Emitted(const HitRecord& rec) const {
+		return Visit<Color>([&](auto& material) { return material.Emitted(rec); });
+	}
+
+	// Only built-in lights are sampled explicitly; emission from custom materials is found by chance.
+	const DiffuseLight* AsLight() const {
+		return As<DiffuseLight>();
+	}
+
+	// The built-in material held, or null if it is of another type.
+	template <typename M>
+	const M* As() const {
+		return std::get_if<M>(&m_value);
+	}
+
+private:
+	template <typename R, typename F>
+	R Visit(F&& f) const {
+		switch (Type()) {
+		case MaterialType::Lambertian:
+			return f(*std::get_if<Lambertian>(&m_value));
+		case MaterialType::Metal:
+			return f(*std::get_if<Metal>(&m_value));
+		case MaterialType::Dielectric:
+			return f(*std::get_if<Dielectric>(&m_value));
+		case MaterialType::DiffuseLight:
+			return f(*std::get_if<DiffuseLight>(&m_value));
+		default:
+			return f(**std::get_if<MaterialPtr>(&m_value));
+		}
+	}
+
+private:
+	std::variant<Lambertian, Metal, Dielectric, DiffuseLight, MaterialPtr> m_value;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Material.hpp"
+
+#include <vector>
+
+// Flat table of every material in a scene. Primitives and hit records refer to
+// materials by MaterialId, so intersecting never copies a shared_ptr or touches its refcount.
+class MaterialTable {
+public:
+	MaterialTable() : m_materials() { }
+
+	MaterialId Add(const AnyMaterial& material) {
+		m_materials.push_back(material);
+		return (MaterialId)(m_materials.size() - 1);
+	}
+
+	const AnyMaterial& operator[](MaterialId id) const {
+		return m_materials[id];
+	}
+
+	MaterialType Type(MaterialId id) const {
+		return m_materials[id].Type();
+	}
+
+	size_t Size() const {
+		return m_materials.size();
+	}
+
+	void Reserve(size_t count) {
+		m_materials.reserve(count);
+	}
+
+	void Clear() {
+		m_materials.clear();
+	}
+
+private:
+	std::vector<AnyMaterial> m_materials;
+};
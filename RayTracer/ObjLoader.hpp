@@ -0,0 +1,236 @@
+#pragma once
+
+#include "MappedFile.hpp"
+#include "Scheduler.hpp"
+#include "TriangleMesh.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Reader for the geometry of Wavefront OBJ files: `v` positions and `f` faces, which may be
+// polygons (split into fans) and may use negative, relative indices. Texture coordinates,
+// normals, groups and materials are skipped; the whole file becomes one flat-shaded mesh.
+//
+// The file is mapped and cut into chunks at line boundaries, which are parsed in parallel.
+// Relative indices are resolved once every chunk knows how many vertices precede it.
+class ObjLoader {
+public:
+	// Loads the mesh at `path`, made of `mat`, and builds its BVH at `quality`, working on the
+	// threads of `pool` if given. `hash` receives a hash of the file's bytes. On failure returns
+	// null and `error` says where and why.
+	static std::shared_ptr<TriangleMesh> Load(const std::string& path, MaterialId mat, BVH::BuildQuality quality, std::string& error,
+		uint64_t& hash, ThreadPool* pool = nullptr) {
+		MappedFile file;
+		if (!file.Open(path)) {
+			error = path + ": cannot open file";
+			return nullptr;
+		}
+		const char* data = reinterpret_cast<const char*>(file.Data());
+		const size_t size = file.Size();
+		hash = hash_bytes(HASH_SEED, data, size) ^ size;
+
+		const size_t workers = pool ? pool->Size() : 1;
+		const size_t chunkCount = std::max<size_t>(1, std::min(workers * 4, size / MIN_CHUNK_SIZE));
+		std::vector<Chunk> chunks(chunkCount);
+		const char* begin = data;
+		for (size_t k = 0; k < chunkCount; ++k) {
+			const char* end = data + size * (k + 1) / chunkCount;
+			const char* newline = end < data + size ? static_cast<const char*>(memchr(end, '\n', data + size - end)) : nullptr;
+			end = newline ? newline + 1 : data + size;
+			chunks[k].begin = begin;
+			chunks[k].end = begin < end ? end : begin;
+			begin = chunks[k].end;
+		}
+
+		ForEachChunk(pool, chunkCount, [&](size_t k) { Parse(chunks[k]); });
+
+		size_t vertexCount = 0, triangleCount = 0, lines = 0;
+		std::vector<size_t> vertexBase(chunkCount), triangleBase(chunkCount);
+		for (size_t k = 0; k < chunkCount; ++k) {
+			if (!chunks[k].error.empty()) {
+				error = path + ":" + std::to_string(lines + chunks[k].lines) + ": " + chunks[k].error;
+				return nullptr;
+			}
+			lines += chunks[k].lines;
+			vertexBase[k] = vertexCount;
+			triangleBase[k] = triangleCount;
+			vertexCount += chunks[k].vertices.size();
+			triangleCount += chunks[k].triangles.size();
+		}
+		if (triangleCount == 0) {
+			error = path + ": no faces";
+			return nullptr;
+		}
+		if (vertexCount > RELATIVE) {
+			error = path + ": too many vertices";
+			return nullptr;
+		}
+
+		FlatArray<TriangleMesh::Vertex> vertices;
+		FlatArray<TriangleMesh::Triangle> triangles;
+		vertices.resize(vertexCount);
+		triangles.resize(triangleCount);
+		TriangleMesh::Vertex* vertexOut = vertices.begin();
+		TriangleMesh::Triangle* triangleOut = triangles.begin();
+		std::vector<char> outOfRange(chunkCount, 0);
+		ForEachChunk(pool, chunkCount, [&](size_t k) {
+			const Chunk& chunk = chunks[k];
+			std::copy(chunk.vertices.begin(), chunk.vertices.end(), vertexOut + vertexBase[k]);
+			TriangleMesh::Triangle* out = triangleOut + triangleBase[k];
+			for (const TriangleMesh::Triangle& tri : chunk.triangles) {
+				for (int i = 0; i < 3; ++i) {
+					const int64_t index = Resolve(tri.v[i], vertexBase[k]);
+					outOfRange[k] |= index < 0 || (size_t)index >= vertexCount;
+					out->v[i] = (uint32_t)index;
+				}
+				++out;
+			}
+		});
+		for (char bad : outOfRange) {
+			if (bad) {
+				error = path + ": face refers to a vertex that does not exist";
+				return nullptr;
+			}
+		}
+
+		auto mesh = std::make_shared<TriangleMesh>(std::move(vertices), std::move(triangles), mat);
+		mesh->Build(quality, pool);
+		return mesh;
+	}
+
+private:
+	static constexpr size_t MIN_CHUNK_SIZE = 1 << 20;
+	static constexpr uint64_t HASH_SEED = 0x6f626a6d65736821ull;
+	// Set on indices parsed from negative values: the low 31 bits are then a signed offset from
+	// the first vertex of the chunk, which is only known after all chunks are parsed.
+	static constexpr uint32_t RELATIVE = 0x80000000u;
+
+	struct Chunk {
+		const char* begin = nullptr;
+		const char* end = nullptr;
+		std::vector<TriangleMesh::Vertex> vertices;
+		std::vector<TriangleMesh::Triangle> triangles;
+		// Lines parsed, up to and including the failing one.
+		size_t lines = 0;
+		std::string error;
+	};
+
+	template <typename Task>
+	static void ForEachChunk(ThreadPool* pool, size_t count, Task&& task) {
+		if (pool) {
+			pool->ParallelFor(count, [&](size_t k, size_t) { task(k); });
+			return;
+		}
+		for (size_t k = 0; k < count; ++k) {
+			task(k);
+		}
+	}
+
+	static int64_t Resolve(uint32_t index, size_t vertexBase) {
+		if (!(index & RELATIVE)) {
+			return index;
+		}
+		// Sign-extend the 31-bit offset.
+		const int64_t offset = (int64_t)(int32_t)(index << 1) >> 1;
+		return (int64_t)vertexBase + offset;
+	}
+
+	static bool IsSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static const char* SkipSpace(const char* p, const char* end) {
+		while (p < end && IsSpace(*p)) {
+			++p;
+		}
+		return p;
+	}
+
+	static void Parse(Chunk& chunk) {
+		const char* p = chunk.begin;
+		while (p < chunk.end) {
+			const char* newline = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+			const char* lineEnd = newline ? newline : chunk.end;
+			++chunk.lines;
+			if (!ParseLine(chunk, p, lineEnd)) {
+				return;
+			}
+			p = lineEnd + 1;
+		}
+	}
+
+	static bool ParseLine(Chunk& chunk, const char* p, const char* end) {
+		p = SkipSpace(p, end);
+		if (end - p < 2 || !IsSpace(p[1])) {
+			return true;
+		}
+		if (p[0] == 'v') {
+			float xyz[3];
+			p += 1;
+			for (float& value : xyz) {
+				p = SkipSpace(p, end);
+				const std::from_chars_result result = std::from_chars(p, end, value);
+				if (result.ec != std::errc()) {
+					chunk.error = "malformed vertex";
+					return false;
+				}
+				p = result.ptr;
+			}
+			chunk.vertices.emplace_back(xyz[0], xyz[1], xyz[2]);
+		}
+		else if (p[0] == 'f') {
+			uint32_t first = 0, previous = 0;
+			int corners = 0;
+			p += 1;
+			while ((p = SkipSpace(p, end)) < end && *p != '#') {
+				int64_t value;
+				const std::from_chars_result result = std::from_chars(p, end, value);
+				if (result.ec != std::errc() || value == 0) {
+					chunk.error = "malformed face";
+					return false;
+				}
+				// Skip the texture coordinate and normal indices.
+				p = result.ptr;
+				while (p < end && !IsSpace(*p)) {
+					++p;
+				}
+
+				uint32_t index;
+				if (value > 0) {
+					if (value > RELATIVE) {
+						chunk.error = "vertex index out of range";
+						return false;
+					}
+					index = (uint32_t)(value - 1);
+				}
+				else {
+					const int64_t offset = (int64_t)chunk.vertices.size() + value;
+					if (offset < -(int64_t)(RELATIVE >> 1)) {
+						chunk.error = "vertex index out of range";
+						return false;
+					}
+					index = ((uint32_t)offset & ~RELATIVE) | RELATIVE;
+				}
+
+				if (corners == 0) {
+					first = index;
+				}
+				else if (corners >= 2) {
+					chunk.triangles.push_back({ { first, previous, index } });
+				}
+				previous = index;
+				++corners;
+			}
+			if (corners < 3) {
+				chunk.error = "face with fewer than three vertices";
+				return false;
+			}
+		}
+		return true;
+	}
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "Ray.hpp"
+#include "SphereSet.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Renders the first hit of every primary ray, shaded by the cosine between the ray and the
+// surface normal, once with the double and once with the float instantiation of the math
+// core, and compares throughput and the difference between the two images.
+class PrecisionBench {
+public:
+	struct Result {
+		double doubleMrays = 0.0;
+		double floatMrays = 0.0;
+		// Root mean square difference of the 8-bit shaded images.
+		double rmse = 0.0;
+		// Rays whose float traversal settled on a different sphere than the double one.
+		size_t primitiveMismatches = 0;
+	};
+
+	static Result Run(const SphereSet& spheres, const std::vector<Ray>& rays) {
+		std::vector<Vec3f> centersf(spheres.Size());
+		std::vector<float> radiif(spheres.Size());
+		std::vector<Vec3> centers(spheres.Size());
+		std::vector<double> radii(spheres.Size());
+		for (uint32_t i = 0; i < spheres.Size(); ++i) {
+			centers[i] = spheres.Center(i);
+			radii[i] = spheres.Radius(i);
+			centersf[i] = Vec3f(centers[i]);
+			radiif[i] = (float)radii[i];
+		}
+
+		std::vector<Rayf> raysf;
+		raysf.reserve(rays.size());
+		for (const Ray& r : rays) {
+			raysf.emplace_back(r);
+		}
+
+		std::vector<uint8_t> imaged(rays.size()), imagef(rays.size());
+		std::vector<uint32_t> primd(rays.size()), primf(rays.size());
+
+		Result result;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < rays.size(); ++i) {
+			double t;
+			primd[i] = Closest(rays[i], centers, radii, t);
+			imaged[i] = primd[i] == NO_HIT ? 0 : Shade(rays[i], t, centers[primd[i]]);
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		result.doubleMrays = rays.size() / elapsed.count() * 1e-6;
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < rays.size(); ++i) {
+			float tf;
+			primf[i] = Closest(raysf[i], centersf, radiif, tf);
+			if (primf[i] == NO_HIT) {
+				imagef[i] = 0;
+				continue;
+			}
+
+			// Traversal only has to pick the right sphere; the hit point is recomputed in
+			// double against that one sphere, as float t loses precision far from the origin.
+			double t = tf;
+			Refine(rays[i], centers[primf[i]], radii[primf[i]], t);
+			imagef[i] = Shade(rays[i], t, centers[primf[i]]);
+		}
+		elapsed = std::chrono::steady_clock::now() - start;
+		result.floatMrays = rays.size() / elapsed.count() * 1e-6;
+
+		double sum = 0.0;
+		for (size_t i = 0; i < rays.size(); ++i) {
+			double diff = (double)imaged[i] - imagef[i];
+			sum += diff * diff;
+			result.primitiveMismatches += primd[i] != primf[i];
+		}
+		result.rmse = rays.empty() ? 0.0 : std::sqrt(sum / rays.size());
+		return result;
+	}
+
+private:
+	static constexpr uint32_t NO_HIT = ~0u;
+
+	// The same quadratic as Sphere::Intersect, in either precision.
+	template <typename T>
+	static bool IntersectSphere(const RayT<T>& r, const Vec3T<T>& center, T radius, T tmin, T& closest) {
+		auto oc = r.origin() - center;
+		auto half_b = dot(r.direction(), oc);
+		auto c = oc.lengthsq() - radius * radius;
+
+		auto d = half_b * half_b - c;
+		if (!(d > 0)) {
+			return false;
+		}
+
+		auto root = -half_b - std::sqrt(d);
+		if (root < tmin || closest < root) {
+			root = -half_b + std::sqrt(d);
+			if (root < tmin || closest < root) {
+				return false;
+			}
+		}
+		closest = root;
+		return true;
+	}
+
+	template <typename T>
+	static uint32_t Closest(const RayT<T>& r, const std::vector<Vec3T<T>>& centers, const std::vector<T>& radii, T& t) {
+		t = std::numeric_limits<T>::infinity();
+		uint32_t prim = NO_HIT;
+		for (uint32_t i = 0; i < centers.size(); ++i) {
+			if (IntersectSphere(r, centers[i], radii[i], (T)0.000001, t)) {
+				prim = i;
+			}
+		}
+		return prim;
+	}
+
+	// Re-solves for the root nearest the float estimate and keeps the estimate if the
+	// double solve misses (grazing rays).
+	static void Refine(const Ray& r, const Vec3& center, double radius, double& t) {
+		double refined = std::numeric_limits<double>::infinity();
+		double tmin = 0.000001;
+		if (IntersectSphere(r, center, radius, tmin, refined)) {
+			double farRoot = std::numeric_limits<double>::infinity();
+			if (IntersectSphere(r, center, radius, refined * (1 + 1e-9) + tmin, farRoot)
+				&& std::fabs(farRoot - t) < std::fabs(refined - t)) {
+				refined = farRoot;
+			}
+			t = refined;
+		}
+	}
+
+	static uint8_t Shade(const Ray& r, double t, const Vec3& center) {
+		Vec3 normal = (r.at(t) - center).unit();
+		double cosine = std::fabs(dot(normal, r.direction()));
+		return static_cast<uint8_t>(cosine * 255.0);
+	}
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+
+// xoshiro256++ (Blackman & Vigna). 256 bits of state, period 2^256 - 1.
+class Rng {
+public:
+	Rng() : Rng(0) { }
+
+	explicit Rng(uint64_t seed) {
+		Seed(seed);
+	}
+
+	// Independent sequence for (seed, stream), e.g. one per tile. Streams are derived by hashing,
+	// which is O(1) for any stream index; use Jump() when provably disjoint sequences are needed.
+	static Rng Stream(uint64_t seed, uint64_t stream) {
+		return Rng(seed ^ Mix(stream + 0x632be59bd9b4e019ull));
+	}
+
+	void Seed(uint64_t seed) {
+		// splitmix64 expands the seed so that similar seeds still give unrelated states.
+		for (auto& word : m_state) {
+			seed += 0x9e3779b97f4a7c15ull;
+			word = Mix(seed);
+		}
+	}
+
+	uint64_t Next() {
+		const uint64_t result = Rotl(m_state[0] + m_state[3], 23) + m_state[0];
+		const uint64_t t = m_state[1] << 17;
+
+		m_state[2] ^= m_state[0];
+		m_state[3] ^= m_state[1];
+		m_state[1] ^= m_state[2];
+		m_state[0] ^= m_state[3];
+
+		m_state[2] ^= t;
+		m_state[3] = Rotl(m_state[3], 45);
+
+		return result;
+	}
+
+	// Uniform in [0, 1): the top 53 bits scaled by 2^-53.
+	double NextDouble() {
+		return (Next() >> 11) * (1.0 / (uint64_t(1) << 53));
+	}
+
+	// Advances the state by 2^128 steps, equivalent to 2^128 calls to Next().
+	void Jump() {
+		static constexpr uint64_t JUMP[] = {
+			0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c
+		};
+		Advance(JUMP);
+	}
+
+	// Advances the state by 2^192 steps, used to hand out sets of Jump() streams.
+	void LongJump() {
+		static constexpr uint64_t LONG_JUMP[] = {
+			0x76e15d3efefdcbbf, 0xc5004e441c522fb3, 0x77710069854ee241, 0x39109bb02acbe635
+		};
+		Advance(LONG_JUMP);
+	}
+
+private:
+	static uint64_t Rotl(const uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+
+	static uint64_t Mix(uint64_t z) {
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	void Advance(const uint64_t (&poly)[4]) {
+		uint64_t s[4] = {};
+		for (uint64_t word : poly) {
+			for (int b = 0; b < 64; ++b) {
+				if (word & (uint64_t(1) << b)) {
+					for (int i = 0; i < 4; ++i) {
+						s[i] ^= m_state[i];
+					}
+				}
+				Next();
+			}
+		}
+		for (int i = 0; i < 4; ++i) {
+			m_state[i] = s[i];
+		}
+	}
+
+private:
+	uint64_t m_state[4];
+};
+
+// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3"). A counter-based
+// generator: the output is a pure function of (key, counter), so any number can be produced
+// directly from the coordinates it belongs to, e.g. (pixel, sample, dimension), on any thread.
+class Philox {
+public:
+	struct Block {
+		uint32_t v[4];
+	};
+
+	// Stream interface on top of the counter: the counter holds (stream, position).
+	Philox() : Philox(0, 0) { }
+
+	Philox(uint64_t seed, uint64_t stream) : m_key(seed), m_stream(stream), m_position(0) { }
+
+	double NextDouble() {
+		const Block out = Generate(m_key, { { (uint32_t)m_position, (uint32_t)(m_position >> 32),
+			(uint32_t)m_stream, (uint32_t)(m_stream >> 32) } });
+		++m_position;
+		return ToDouble(out.v[0], out.v[1]);
+	}
+
+	static Block Generate(uint64_t key, Block counter) {
+		uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+		for (int round = 0; round < 10; ++round) {
+			const uint64_t p0 = (uint64_t)0xd2511f53u * counter.v[0];
+			const uint64_t p1 = (uint64_t)0xcd9e8d57u * counter.v[2];
+			counter = { { (uint32_t)(p1 >> 32) ^ counter.v[1] ^ k0, (uint32_t)p1,
+				(uint32_t)(p0 >> 32) ^ counter.v[3] ^ k1, (uint32_t)p0 } };
+			k0 += 0x9e3779b9u;
+			k1 += 0xbb67ae85u;
+		}
+		return counter;
+	}
+
+	// Uniform in [0, 1) from 53 of the 64 bits.
+	static double ToDouble(uint32_t hi, uint32_t lo) {
+		return ((((uint64_t)hi << 32) | lo) >> 11) * (1.0 / (uint64_t(1) << 53));
+	}
+
+private:
+	uint64_t m_key;
+	uint64_t m_stream;
+	uint64_t m_position;
+};
\ No newline at end of file
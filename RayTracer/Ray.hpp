@@ -2,25 +2,59 @@
 
 #include "Vec3.hpp"
 
-class Ray {
+#include <cstdint>
+
+// The direction is normalized on construction, so t is a distance along the ray and users
+// never renormalize it. The reciprocal direction and its sign bits are cached for slab tests.
+template <typename T>
+class RayT {
 public:
 
-	Ray() : m_origin(), m_dir() { }
-	Ray(const Point& origin, const Vec3& direction) : m_origin(origin), m_dir(direction) { }
+	RayT() : m_origin(), m_dir(), m_invDir(), m_sign{ 0, 0, 0 } { }
+	RayT(const Vec3T<T>& origin, const Vec3T<T>& direction) : m_origin(origin), m_dir(direction.unit()) {
+		CacheReciprocal();
+	}
+
+	template <typename U>
+	explicit RayT(const RayT<U>& rhs) : m_origin(rhs.origin()), m_dir(Vec3T<T>(rhs.direction()).unit()) {
+		CacheReciprocal();
+	}
 
-	const Vec3 at(double t) const {
+	const Vec3T<T> at(T t) const {
 		return m_origin + t * m_dir;
 	}
 
-	const Vec3& origin() const {
+	const Vec3T<T>& origin() const {
 		return m_origin;
 	}
 
-	const Vec3& direction() const {
+	// Unit length.
+	const Vec3T<T>& direction() const {
 		return m_dir;
 	}
 
+	const Vec3T<T>& invDirection() const {
+		return m_invDir;
+	}
+
+	// 1 if the direction is negative along the axis.
+	int sign(int axis) const {
+		return m_sign[axis];
+	}
+
 private:
-	Vec3 m_origin;
-	Vec3 m_dir;
-};
\ No newline at end of file
+	void CacheReciprocal() {
+		m_invDir = Vec3T<T>(1 / m_dir.x, 1 / m_dir.y, 1 / m_dir.z);
+		m_sign[0] = m_invDir.x < 0;
+		m_sign[1] = m_invDir.y < 0;
+		m_sign[2] = m_invDir.z < 0;
+	}
+
+	Vec3T<T> m_origin;
+	Vec3T<T> m_dir;
+	Vec3T<T> m_invDir;
+	uint8_t m_sign[3];
+};
+
+typedef RayT<double> Ray;
+typedef RayT<float> Rayf;
@@ -5,23 +5,59 @@
 #include "hittable.hpp"
 #include "Camera.hpp"
 #include "Material.hpp"
+#include "World.hpp"
+#include "Sampler.hpp"
+#include "Framebuffer.hpp"
+#include "Checkpoint.hpp"
+#include "SceneFile.hpp"
+#include "SceneCache.hpp"
+#include "Scheduler.hpp"
+#include "PrecisionBench.hpp"
+#include "UpdateCheck.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <vector>
 #include <optional>
+#include <string>
 #include <iostream>
 #include <iomanip>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 
 
 class RayTracer {
 public:
+	// Mixed is the ~500 sphere scene with random materials from the end of the book.
+	// Enclosed is a closed box lit only by a small sphere light.
+	enum class BuiltinScene {
+		Default,
+		Mixed,
+		Enclosed
+	};
+
 	RayTracer() = delete;
 
-	RayTracer(const size_t width, const size_t height) : 
+	// threadCount == 0 uses every hardware thread.
+	RayTracer(const size_t width, const size_t height, size_t threadCount = 0) : 
 		m_width(width), m_height(height), m_aspectRatio((double)width/height),
 		m_data(width * height * 3, 0x00),
-	    m_vertical(), m_horizontal(), m_lowerleft(), m_origin() {
+	    m_vertical(), m_horizontal(), m_lowerleft(), m_origin(),
+		m_pool(), m_seed(DEFAULT_SEED), m_accel(World::AccelMode::BVH), m_buildQuality(BVH::BuildQuality::High),
+		m_scene(BuiltinScene::Default), m_sampler(SamplerType::Sobol), m_maxDepth(DEFAULT_MAX_DEPTH), m_nextEventEstimation(true),
+		m_minSamples(DEFAULT_SAMPLES), m_maxSamples(DEFAULT_SAMPLES), m_targetError(0.0),
+		m_framebuffer(width, height), m_checkpoint(), m_checkpointInterval(DEFAULT_CHECKPOINT_INTERVAL),
+		m_resumeSample(0), m_resumed(false), m_world(), m_camera(), m_sceneHash(0), m_background(),
+		m_rayCount(0), m_pathCount(0) {
+
+		if (threadCount == 0) {
+			threadCount = std::thread::hardware_concurrency();
+		}
+		m_pool = std::make_unique<ThreadPool>(threadCount);
 
 		const double viewport_height = 2.0;
 		const double viewport_width = m_aspectRatio * viewport_height;
@@ -36,16 +72,358 @@ public:
 		return m_data.data();
 	}
 
+	// Linear radiance sums and sample counts from the last Run(), before display encoding.
+	const Framebuffer& GetFramebuffer() const {
+		return m_framebuffer;
+	}
+
+	size_t GetThreadCount() const {
+		return m_pool->Size();
+	}
+
+	void SetSeed(uint64_t seed) {
+		m_seed = seed;
+	}
+
+	void SetAccelMode(World::AccelMode mode) {
+		m_accel = mode;
+	}
+
+	void SetBuildQuality(BVH::BuildQuality quality) {
+		m_buildQuality = quality;
+	}
+
+	void SetScene(BuiltinScene scene) {
+		m_scene = scene;
+	}
+
+	// Renders `world`, filled from a scene file, instead of a built-in scene. `sceneHash`
+	// identifies the scene to checkpoints.
+	void SetWorld(std::unique_ptr<World> world, const Camera& camera, uint64_t sceneHash) {
+		m_world = std::move(world);
+		m_camera = camera;
+		m_sceneHash = sceneHash;
+	}
+
+	// The world given to SetWorld(), for moving its spheres between calls to Run(); each run
+	// refits the BVH to the changes instead of rebuilding it.
+	World* GetWorld() {
+		return m_world.get();
+	}
+
+	// Constant radiance for rays that leave the scene, in place of the sky gradient.
+	void SetBackground(const Color& background) {
+		m_background = background;
+	}
+
+	void SetSampler(SamplerType type) {
+		m_sampler = type;
+	}
+
+	// Hard limit on path length; Russian roulette ends most paths long before it.
+	void SetMaxDepth(int depth) {
+		m_maxDepth = depth;
+	}
+
+	// Sample lights directly at every non-specular bounce. Off leaves only BSDF sampling,
+	// which is useful to compare against.
+	void SetNextEventEstimation(bool enabled) {
+		m_nextEventEstimation = enabled;
+	}
+
+	// Every pixel takes at least minSamples and stops once the 95% confidence interval of its
+	// luminance is within targetError of the mean, or at maxSamples. targetError <= 0 disables
+	// the test so every pixel takes maxSamples.
+	void SetSampling(int minSamples, int maxSamples, double targetError) {
+		m_maxSamples = std::max(1, maxSamples);
+		m_minSamples = std::clamp(minSamples, 1, m_maxSamples);
+		m_targetError = targetError;
+	}
+
+	// Writes a checkpoint to `path` every `intervalSeconds` of rendering (at the end of the
+	// sample pass that crosses it) and once the render finishes.
+	void SetCheckpoint(const std::string& path, double intervalSeconds) {
+		m_checkpoint = std::make_unique<Checkpoint>(path);
+		m_checkpointInterval = intervalSeconds;
+	}
+
+	// Loads the checkpoint set with SetCheckpoint() so the next Run() carries on from it. Must
+	// come after every other setting, which have to match the ones the checkpoint was made with.
+	bool Resume() {
+		if (!m_checkpoint) {
+			return false;
+		}
+		std::string error;
+		uint32_t samplesDone = 0;
+		if (!Checkpoint::Load(m_checkpoint->Path(), GetSettings(), samplesDone, m_framebuffer, error)) {
+			std::cout << "Cannot resume from " << m_checkpoint->Path() << ": " << error << std::endl;
+			m_framebuffer.Clear();
+			return false;
+		}
+		m_resumeSample = (int)samplesDone;
+		m_resumed = true;
+		return true;
+	}
+
+	// Grayscale image of the samples each pixel took, scaled so maxSamples is white.
+	std::vector<byte> GetSampleCountBitmap() const {
+		std::vector<byte> bitmap(m_width * m_height * 3);
+		for (size_t i = 0; i < m_width * m_height; ++i) {
+			byte value = static_cast<byte>(clamp((double)m_framebuffer.Count(i % m_width, i / m_width) / m_maxSamples) * BYTE_MAX);
+			bitmap[3 * i] = bitmap[3 * i + 1] = bitmap[3 * i + 2] = value;
+		}
+		return bitmap;
+	}
+
+	// Number of rays intersected with the world during the last Run().
+	uint64_t GetRayCount() const {
+		return m_rayCount;
+	}
+
+	// Average number of rays per camera path during the last Run().
+	double GetAveragePathLength() const {
+		return m_pathCount ? (double)m_rayCount / m_pathCount : 0.0;
+	}
+
+	double GetAverageSamplesPerPixel() const {
+		return (double)m_pathCount / (m_width * m_height);
+	}
+
 	void Run() {
-		static const Vec3 origin = Vec3(0.0, 0.0, 0.0);
+		World builtinWorld;
+		World& world = m_world ? *m_world : builtinWorld;
+		world.SetAccelMode(m_accel);
+		world.SetBuildQuality(m_buildQuality);
+
+		Camera camera = m_world ? *m_camera : BuildScene(world);
+
+		// A world loaded from a scene cache arrives with its BVH already built.
+		if (!world.IsBuilt()) {
+			auto buildStart = std::chrono::steady_clock::now();
+			world.Build(m_pool.get());
+			std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildStart;
+			if (m_accel == World::AccelMode::BVH) {
+				std::cout << "BVH built: " << world.BVHNodeCount() << " nodes in " << buildTime.count() << "ms ("
+					<< (world.Spheres().Size() + world.Instances().Size()) / buildTime.count() * 1e-3 << " Mprims/s)" << std::endl;
+			}
+		}
+		// Spheres changed since the last frame: refit, or rebuild if the tree got too poor.
+		else if (world.NeedsUpdate()) {
+			auto updateStart = std::chrono::steady_clock::now();
+			const bool rebuilt = world.Update(m_pool.get());
+			std::chrono::duration<double, std::milli> updateTime = std::chrono::steady_clock::now() - updateStart;
+			std::cout << (rebuilt ? "BVH rebuilt" : "BVH refit") << " in " << updateTime.count() << "ms";
+			if (!rebuilt) {
+				std::cout << ", SAH cost " << world.RefitCostRatio() << "x that of the built tree";
+			}
+			std::cout << std::endl;
+		}
+
+		const size_t tilesX = (m_width + TILE_SIZE - 1) / TILE_SIZE;
+		const size_t tilesY = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+		const size_t tileCount = tilesX * tilesY;
+
+		std::mutex progressLock;
+		m_rayCount = 0;
+		m_pathCount = 0;
+
+		int firstSample = 0;
+		if (m_resumed) {
+			firstSample = m_resumeSample;
+			m_resumed = false;
+			std::cout << "Resuming after " << firstSample << " samples per pixel" << std::endl;
+		}
+		else {
+			m_framebuffer.Clear();
+		}
+
+		// Samples are taken in passes over the whole image so a checkpoint can be cut between
+		// them. The pass boundaries are the same whether or not the render was resumed, so the
+		// sums are rounded identically too.
+		const size_t passCount = (m_maxSamples + SAMPLES_PER_PASS - 1) / SAMPLES_PER_PASS;
+		const RenderSettings settings = GetSettings();
+		auto renderStart = std::chrono::steady_clock::now();
+		auto lastCheckpoint = renderStart;
+		for (int passStart = firstSample; passStart < m_maxSamples; passStart += SAMPLES_PER_PASS) {
+			const int passEnd = std::min(passStart + SAMPLES_PER_PASS, m_maxSamples);
+			const size_t pass = passStart / SAMPLES_PER_PASS;
+			size_t tilesDone = 0;
+			m_pool->ParallelFor(tileCount, [&](size_t tile, size_t) {
+				PathStats stats = RenderTile(tile % tilesX, tile / tilesX, passStart, passEnd, world, camera);
+				m_rayCount += stats.rays;
+				m_pathCount += stats.paths;
+
+				std::lock_guard<std::mutex> lock(progressLock);
+				double percent = (double)(pass * tileCount + ++tilesDone) / (passCount * tileCount) * 100;
+				std::cout << "Completed: " << std::setprecision(4) << std::setw(7) << percent << "%\r";
+			});
+
+			auto now = std::chrono::steady_clock::now();
+			if (m_checkpoint && (passEnd == m_maxSamples
+				|| std::chrono::duration<double>(now - lastCheckpoint).count() >= m_checkpointInterval)) {
+				m_checkpoint->SaveAsync(settings, (uint32_t)passEnd, m_framebuffer);
+				lastCheckpoint = now;
+			}
+		}
+		std::chrono::duration<double> renderTime = std::chrono::steady_clock::now() - renderStart;
+		m_framebuffer.Encode(m_data);
+		if (m_checkpoint && !m_checkpoint->Wait()) {
+			std::cout << std::endl << "Failed to write checkpoint " << m_checkpoint->Path();
+		}
+		std::cout << std::endl << "Rays traced: " << m_rayCount << " ("
+			<< m_rayCount / renderTime.count() * 1e-6 << " Mrays/s), average path length "
+			<< GetAveragePathLength() << ", " << GetAverageSamplesPerPixel() << " samples per pixel" << std::endl;
+	}
+
+	// Traces one primary ray per pixel through the scene with the float and the double
+	// instantiation of the math core and prints their throughput and image difference.
+	void BenchmarkPrecision() {
 		World world;
+		Camera camera = BuildScene(world);
 
-		constexpr int SAMPLE_COUNT = 4;
+		seed_random(m_seed);
+		std::vector<Ray> rays;
+		rays.reserve(m_width * m_height);
+		for (size_t j = 0; j < m_height; ++j) {
+			for (size_t i = 0; i < m_width; ++i) {
+				rays.push_back(camera.RayTo(((double)i + 0.5) / (m_width - 1), ((double)j + 0.5) / (m_height - 1)));
+			}
+		}
 
-		MaterialPtr ground = make_shared<Lambertian>(Color(0.8, 0.8, 0.0));
-		MaterialPtr center = make_shared<Lambertian>(Color(0.7, 0.3, 0.3));
-		MaterialPtr left = make_shared<Dielectric>(1.5);
-		MaterialPtr right = make_shared<Metal>(Color(0.8, 0.6, 0.2), 1.0);
+		PrecisionBench::Result result = PrecisionBench::Run(world.Spheres(), rays);
+		std::cout << "double: " << result.doubleMrays << " Mrays/s" << std::endl;
+		std::cout << "float:  " << result.floatMrays << " Mrays/s (hits refined in double)" << std::endl;
+		std::cout << "RMSE:   " << result.rmse << " (8-bit), " << result.primitiveMismatches
+			<< " of " << rays.size() << " rays hit a different sphere" << std::endl;
+	}
+
+	// Runs UpdateCheck with the render seed and prints what it found. True if the edited world
+	// always matched the freshly built one.
+	bool CheckUpdates() {
+		UpdateCheck::Result result = UpdateCheck::Run(m_seed, m_pool.get());
+		std::cout << "Update check: " << result.frames << " frames of edits, " << result.rebuilds << " of them rebuilt" << std::endl;
+		std::cout << result.mismatches << " of " << result.rays << " rays and " << result.countMismatches << " of "
+			<< result.frames << " light and sphere counts differed from a fresh build" << std::endl;
+		return result.mismatches == 0 && result.countMismatches == 0;
+	}
+
+private:
+
+	static constexpr size_t TILE_SIZE = 16;
+	static constexpr uint64_t DEFAULT_SEED = 1;
+	static constexpr int DEFAULT_MAX_DEPTH = 50;
+	static constexpr int DEFAULT_SAMPLES = 4;
+	// Samples per pixel between checkpoint opportunities.
+	static constexpr int SAMPLES_PER_PASS = 16;
+	static constexpr double DEFAULT_CHECKPOINT_INTERVAL = 300.0;
+	// Relative errors are measured against at least this luminance so black pixels can converge.
+	static constexpr double MIN_ERROR_LUMINANCE = 0.01;
+	// Bounces that always survive before Russian roulette may end the path.
+	static constexpr int ROULETTE_START_DEPTH = 3;
+	// Closest distance a scattered ray may hit anything, to keep it off its own surface.
+	static constexpr double HIT_EPSILON = 0.000001;
+	// Relative amount shadow rays stop short of the light they were aimed at.
+	static constexpr double SHADOW_EPSILON = 0.000001;
+	// Sampler dimensions: pixel position (2) and lens (2), then per bounce the material's,
+	// light sampling (pick a light, then a direction) and Russian roulette.
+	static constexpr uint32_t FIRST_BOUNCE_DIMENSION = 4;
+	static constexpr uint32_t LIGHT_DIMENSIONS = 3;
+	static constexpr uint32_t BOUNCE_DIMENSIONS = Material::BSDF_DIMENSIONS + LIGHT_DIMENSIONS + 1;
+
+	struct PathStats {
+		uint64_t rays = 0;
+		uint64_t paths = 0;
+	};
+
+	RenderSettings GetSettings() const {
+		RenderSettings settings;
+		settings.width = m_width;
+		settings.height = m_height;
+		settings.seed = m_seed;
+		settings.targetError = m_targetError;
+		settings.sceneHash = m_world ? m_sceneHash : 0;
+		settings.scene = (uint32_t)m_scene;
+		settings.sampler = (uint32_t)m_sampler;
+		settings.nextEventEstimation = m_nextEventEstimation;
+		settings.maxDepth = m_maxDepth;
+		settings.minSamples = m_minSamples;
+		settings.maxSamples = m_maxSamples;
+		return settings;
+	}
+
+	// Adaptive sampling stop test on a pixel's first k samples.
+	bool Converged(int k, const Framebuffer::Moments& moments) const {
+		if (m_targetError <= 0.0 || k < std::max(m_minSamples, 2)) {
+			return false;
+		}
+		double halfWidth = 1.96 * sqrt(moments.m2 / (k - 1) / k);
+		return halfWidth <= m_targetError * std::max(moments.mean, MIN_ERROR_LUMINANCE);
+	}
+
+	// Takes samples [sampleBegin, sampleEnd) of every pixel in the tile that has not converged.
+	PathStats RenderTile(size_t tx, size_t ty, int sampleBegin, int sampleEnd, World& world, const Camera& camera) {
+		// Samplers are keyed by pixel and sample index, so no pixel depends on which worker renders it.
+		std::unique_ptr<Sampler> sampler = Sampler::Create(m_sampler, m_seed);
+		PathStats stats;
+
+		const size_t jEnd = std::min(m_height, (ty + 1) * TILE_SIZE);
+		const size_t iEnd = std::min(m_width, (tx + 1) * TILE_SIZE);
+
+		for (size_t j = ty * TILE_SIZE; j < jEnd; ++j) {
+
+			for (size_t i = tx * TILE_SIZE; i < iEnd; ++i) {
+				// Welford's running mean and variance of the sample luminance.
+				Framebuffer::Moments& moments = m_framebuffer.LuminanceMoments(i, j);
+				int k = sampleBegin;
+				if ((int)m_framebuffer.Count(i, j) < k || Converged(k, moments)) {
+					continue;
+				}
+
+				Color pixelColor;
+				while (k < sampleEnd) {
+					sampler->StartSample((uint32_t)i, (uint32_t)j, (uint32_t)k);
+					double du, dv, lensU1, lensU2;
+					sampler->Get2D(du, dv);
+					sampler->Get2D(lensU1, lensU2);
+					double u = ((double)i + du) / (m_width - 1);
+					double v = ((double)j + dv) / (m_height - 1);
+
+					Ray ray = camera.RayTo(u, v, lensU1, lensU2);
+					Color sample = ColorAt(ray, world, *sampler, stats);
+					pixelColor += sample;
+					++k;
+
+					double y = 0.2126 * sample.r() + 0.7152 * sample.g() + 0.0722 * sample.b();
+					double delta = y - moments.mean;
+					moments.mean += delta / k;
+					moments.m2 += delta * (y - moments.mean);
+
+					if (Converged(k, moments)) {
+						break;
+					}
+				}
+				m_framebuffer.Add(i, j, pixelColor, (uint32_t)(k - sampleBegin));
+			}
+		}
+		return stats;
+	}
+
+	Camera BuildScene(World& world) const {
+		switch (m_scene) {
+		case BuiltinScene::Mixed:
+			return BuildMixedScene(world);
+		case BuiltinScene::Enclosed:
+			return BuildEnclosedScene(world);
+		default:
+			return BuildDefaultScene(world);
+		}
+	}
+
+	Camera BuildDefaultScene(World& world) const {
+		MaterialId ground = world.AddMaterial(Lambertian(Color(0.8, 0.8, 0.0)));
+		MaterialId center = world.AddMaterial(Lambertian(Color(0.7, 0.3, 0.3)));
+		MaterialId left = world.AddMaterial(Dielectric(1.5));
+		MaterialId right = world.AddMaterial(Metal(Color(0.8, 0.6, 0.2), 1.0));
 
 		world.AddSphere(Point(0.0, -100.5, -1.0), 100.0, ground);
 		world.AddSphere(Point(0.0, 0.0, -1.0), 0.5, center);
@@ -55,65 +433,175 @@ public:
 		Point lookfrom(-2, 2, 1), lookat(0, 0, -1);
 		auto focus_dist = (lookfrom - lookat).length(), aperture = 2.0;
 
-		Camera camera(m_width, m_height, 20, lookfrom, lookat, Vec3(0, 1, 0), focus_dist, aperture);
+		return Camera(m_width, m_height, 20, lookfrom, lookat, Vec3(0, 1, 0), focus_dist, aperture);
+	}
 
-		constexpr int MAX_REFLECT = 5;
-		auto scale = 1.0 / SAMPLE_COUNT;
+	Camera BuildMixedScene(World& world) const {
+		// Own generator so the scene is the same whatever the render seed or thread.
+		Rng rng(m_seed);
+		auto rnd = [&rng](double min = 0.0, double max = 1.0) { return min + (max - min) * rng.NextDouble(); };
 
-		for (size_t j = 0; j < m_height; ++j) {
+		world.AddSphere(Point(0, -1000, 0), 1000, world.AddMaterial(Lambertian(Color(0.5, 0.5, 0.5))));
 
-			for (size_t i = 0; i < m_width; ++i) {
-				Color pixelColor;
+		for (int a = -11; a < 11; ++a) {
+			for (int b = -11; b < 11; ++b) {
+				double choose = rnd();
+				Point center(a + 0.9 * rnd(), 0.2, b + 0.9 * rnd());
+				if ((center - Point(4, 0.2, 0)).length() <= 0.9) {
+					continue;
+				}
+
+				MaterialId mat;
+				if (choose < 0.8) {
+					mat = world.AddMaterial(Lambertian(Color(rnd() * rnd(), rnd() * rnd(), rnd() * rnd())));
+				}
+				else if (choose < 0.95) {
+					mat = world.AddMaterial(Metal(Color(rnd(0.5, 1), rnd(0.5, 1), rnd(0.5, 1)), (float)rnd(0, 0.5)));
+				}
+				else {
+					mat = world.AddMaterial(Dielectric(1.5));
+				}
+				world.AddSphere(center, 0.2, mat);
+			}
+		}
+
+		world.AddSphere(Point(0, 1, 0), 1.0, world.AddMaterial(Dielectric(1.5)));
+		world.AddSphere(Point(-4, 1, 0), 1.0, world.AddMaterial(Lambertian(Color(0.4, 0.2, 0.1))));
+		world.AddSphere(Point(4, 1, 0), 1.0, world.AddMaterial(Metal(Color(0.7, 0.6, 0.5), 0.0)));
+
+		Point lookfrom(13, 2, 3), lookat(0, 0, 0);
+		return Camera(m_width, m_height, 20, lookfrom, lookat, Vec3(0, 1, 0), 10.0, 0.1);
+	}
+
+	// Smallpt-style room: the walls are huge spheres, so the box stays closed and the sky never shows.
+	Camera BuildEnclosedScene(World& world) const {
+		MaterialId white = world.AddMaterial(Lambertian(Color(0.75, 0.75, 0.75)));
+		MaterialId red = world.AddMaterial(Lambertian(Color(0.75, 0.25, 0.25)));
+		MaterialId blue = world.AddMaterial(Lambertian(Color(0.25, 0.25, 0.75)));
+		MaterialId light = world.AddMaterial(DiffuseLight(Color(40.0, 40.0, 40.0)));
 
-				for (size_t k = 0; k < SAMPLE_COUNT; ++k) {
-					double u = ((double)i + random_double()) / (m_width - 1);
-					double v = ((double)j + random_double()) / (m_height - 1);
+		const double wall = 1e5;
+		world.AddSphere(Point(-wall, 0, 0), wall - 1, red);
+		world.AddSphere(Point(wall, 0, 0), wall - 1, blue);
+		world.AddSphere(Point(0, -wall, 0), wall - 1, white);
+		world.AddSphere(Point(0, wall, 0), wall - 1, white);
+		world.AddSphere(Point(0, 0, -wall), wall - 1, white);
+		world.AddSphere(Point(0, 0, wall), wall - 4, white);
 
-					Ray ray = camera.RayTo(u, v);
-					pixelColor += ColorAt(ray, world, MAX_REFLECT);
+		world.AddSphere(Point(-0.45, -0.65, -0.3), 0.35, world.AddMaterial(Metal(Color(0.95, 0.95, 0.95), 0.0)));
+		world.AddSphere(Point(0.45, -0.65, 0.2), 0.35, world.AddMaterial(Dielectric(1.5)));
+		world.AddSphere(Point(0.0, 0.8, 0.0), 0.1, light);
+
+		Point lookfrom(0, 0, 3.9), lookat(0, 0, 0);
+		return Camera(m_width, m_height, 40, lookfrom, lookat, Vec3(0, 1, 0), 3.9, 0.0);
+	}
+
+	// Iterative path tracer: tracks the product of sample weights along the path and, once past
+	// ROULETTE_START_DEPTH, ends the path with probability 1 - max(throughput), dividing the
+	// survivors by the survival probability so the estimate stays unbiased.
+	//
+	// Emitters are reached two ways, by light sampling at each non-specular bounce and by the
+	// BSDF sample happening to hit one; the power heuristic weights the two so neither counts twice.
+	const Color ColorAt(Ray ray, World & world, Sampler& sampler, PathStats& stats) {
+		static constexpr double F_INFINITE = std::numeric_limits<double>::infinity();
+
+		++stats.paths;
+		Color radiance;
+		Color throughput(1.0, 1.0, 1.0);
+		// Density of the BSDF sample that produced `ray`. Zero for camera rays and specular
+		// bounces, which light sampling cannot reproduce, so the emitters they hit count in full.
+		double bsdfPdf = 0.0;
+		Point previous;
+		for (int depth = 0; depth < m_maxDepth; ++depth) {
+			HitRecord rec;
+			++stats.rays;
+			if (!world.isHit(ray, rec, HIT_EPSILON, F_INFINITE)) {
+				radiance += throughput * SkyColor(ray);
+				break;
+			}
+
+			const AnyMaterial& material = world.GetMaterial(rec.mat);
+			const Color emitted = material.Emitted(rec);
+			if (!IsBlack(emitted)) {
+				double weight = 1.0;
+				if (m_nextEventEstimation && bsdfPdf > 0.0) {
+					weight = PowerHeuristic(bsdfPdf, world.LightPdf(previous, rec.prim));
 				}
+				radiance += weight * (throughput * emitted);
+			}
 
-				// Anti-aliasing
-				pixelColor *= scale;
+			const uint32_t dimension = FIRST_BOUNCE_DIMENSION + depth * BOUNCE_DIMENSIONS;
+			const Vec3 wo = -ray.direction();
+			ScatterRecord srec;
+			sampler.SetDimension(dimension);
+			const bool scattered = material.Sample(rec, wo, sampler, srec);
+			if (m_nextEventEstimation && !srec.isSpecular && world.LightCount() > 0) {
+				sampler.SetDimension(dimension + Material::BSDF_DIMENSIONS);
+				radiance += throughput * DirectLight(world, material, rec, wo, sampler, stats);
+			}
+			if (!scattered) {
+				break;
+			}
 
-				// Gamma correction
-				pixelColor.r = sqrt(pixelColor.r/* * scale*/);
-				pixelColor.g = sqrt(pixelColor.g/* * scale*/);
-				pixelColor.b = sqrt(pixelColor.b /** scale*/);
+			throughput = throughput * srec.weight;
+			bsdfPdf = srec.isSpecular ? 0.0 : srec.pdf;
+			previous = rec.point;
+			ray = Ray(rec.point, srec.direction);
 
-				size_t index = (i + m_width * j) * 3;
-				m_data[index] = static_cast<byte>(clamp(pixelColor.r) * BYTE_MAX);
-				m_data[index + 1] = static_cast<byte>(clamp(pixelColor.g) * BYTE_MAX);
-				m_data[index + 2] = static_cast<byte>(clamp(pixelColor.b) * BYTE_MAX);
+			if (depth + 1 >= ROULETTE_START_DEPTH) {
+				double survival = std::min(0.95, std::max({ throughput.r(), throughput.g(), throughput.b() }));
+				sampler.SetDimension(dimension + Material::BSDF_DIMENSIONS + LIGHT_DIMENSIONS);
+				if (sampler.Get1D() >= survival) {
+					break;
+				}
+				throughput /= survival;
 			}
-			double percent = (double)j / (m_width - 1) * 100;
-			std::cout << "Completed: " << std::setprecision(4) << std::setw(7) << percent << "%\r";
 		}
+		return radiance;
 	}
 
-private:
-
-	const Color ColorAt(const Ray& ray, Hittable & world, int depth) {
-		static constexpr double F_INFINITE = std::numeric_limits<double>::infinity();
+	// Next-event estimation: one shadow ray towards a sampled point on a light, MIS weighted.
+	Color DirectLight(const World& world, const AnyMaterial& material, const HitRecord& rec, const Vec3& wo,
+		Sampler& sampler, PathStats& stats) const
+	{
+		const double u0 = sampler.Get1D();
+		double u1, u2;
+		sampler.Get2D(u1, u2);
+		LightSample ls;
+		if (!world.SampleLight(rec.point, u0, u1, u2, ls)) {
+			return Color(0.0, 0.0, 0.0);
+		}
 
-		if (depth <= 0) {
-			return Color(0, 0, 0); // Absolute black
+		const Color f = material.Evaluate(rec, wo, ls.direction);
+		if (IsBlack(f)) {
+			return Color(0.0, 0.0, 0.0);
 		}
 
-		HitRecord rec;
-		if (world.isHit(ray, rec, 0.000001, F_INFINITE)) {
-			Ray scattered;
-			Color attenuation;
-			if (rec.mat->Scatter(ray, rec, attenuation, scattered)) {
-				return attenuation * ColorAt(scattered, world, depth-1);
-			}
+		++stats.rays;
+		// Stop just short of the light so the light itself does not count as an occluder.
+		if (world.isOccluded(Ray(rec.point, ls.direction), HIT_EPSILON, ls.distance * (1.0 - SHADOW_EPSILON))) {
 			return Color(0.0, 0.0, 0.0);
 		}
-		return SkyColor(ray);
+
+		const double weight = PowerHeuristic(ls.pdf, material.Pdf(rec, wo, ls.direction));
+		return (weight / ls.pdf) * (f * ls.emitted);
+	}
+
+	static double PowerHeuristic(double pdf, double otherPdf) {
+		pdf *= pdf;
+		otherPdf *= otherPdf;
+		return pdf / (pdf + otherPdf);
+	}
+
+	static bool IsBlack(const Color& c) {
+		return c.r() <= 0.0 && c.g() <= 0.0 && c.b() <= 0.0;
 	}
 
 	const Color SkyColor(const Ray & r) const {
-		double t = (1.0 + r.direction().unit().y) * 0.5;
+		if (m_background) {
+			return *m_background;
+		}
+		double t = (1.0 + r.direction().y) * 0.5;
 		return (1.0 - t) * Color(1.0, 1.0, 1.0) + t * Color(0.5, 0.7f, 1.0);
 	}
 
@@ -128,4 +616,28 @@ private:
 	Vec3 m_vertical;
 	Vec3 m_horizontal;
 	Vec3 m_lowerleft;
+
+	std::unique_ptr<ThreadPool> m_pool;
+	uint64_t m_seed;
+	World::AccelMode m_accel;
+	BVH::BuildQuality m_buildQuality;
+	BuiltinScene m_scene;
+	SamplerType m_sampler;
+	int m_maxDepth;
+	bool m_nextEventEstimation;
+	int m_minSamples;
+	int m_maxSamples;
+	double m_targetError;
+	Framebuffer m_framebuffer;
+	std::unique_ptr<Checkpoint> m_checkpoint;
+	double m_checkpointInterval;
+	int m_resumeSample;
+	bool m_resumed;
+	// Scene loaded from a file; null renders m_scene.
+	std::unique_ptr<World> m_world;
+	std::optional<Camera> m_camera;
+	uint64_t m_sceneHash;
+	std::optional<Color> m_background;
+	std::atomic<uint64_t> m_rayCount;
+	std::atomic<uint64_t> m_pathCount;
 };
\ No newline at end of file
@@ -0,0 +1,227 @@
+#pragma once
+
+#include "BlueNoise.hpp"
+#include "Random.hpp"
+
+#include <cstdint>
+#include <memory>
+
+enum class SamplerType {
+	Independent,
+	Sobol,
+	BlueNoise
+};
+
+// Source of the uniform numbers for one pixel sample. Every number a sample needs has a fixed
+// dimension index: StartSample() rewinds to dimension 0 and SetDimension() jumps to a given one,
+// so the same decision (say, the lens position or the second bounce's direction) reads the
+// same dimension in every sample even when paths take different branches.
+class Sampler {
+public:
+	virtual ~Sampler() = default;
+
+	virtual void StartSample(uint32_t x, uint32_t y, uint32_t index) = 0;
+
+	void SetDimension(uint32_t dimension) {
+		m_dimension = dimension;
+	}
+
+	// Uniform in [0, 1); consumes one dimension.
+	virtual double Get1D() = 0;
+	// Two dimensions that are stratified together, for the 2D warps in Sampling.hpp.
+	virtual void Get2D(double& u1, double& u2) = 0;
+
+	static std::unique_ptr<Sampler> Create(SamplerType type, uint64_t seed);
+
+protected:
+	Sampler() : m_dimension(0) { }
+
+	uint32_t m_dimension;
+};
+
+// Plain Monte Carlo: every dimension is an independent random number, computed by Philox
+// straight from (pixel, sample index, dimension) under the seed.
+class IndependentSampler final : public Sampler {
+public:
+	explicit IndependentSampler(uint64_t seed) : m_seed(seed), m_x(0), m_y(0), m_index(0) { }
+
+	void StartSample(uint32_t x, uint32_t y, uint32_t index) override {
+		m_x = x;
+		m_y = y;
+		m_index = index;
+		m_dimension = 0;
+	}
+
+	double Get1D() override {
+		const Philox::Block out = Philox::Generate(m_seed, { { m_x, m_y, m_index, m_dimension } });
+		++m_dimension;
+		return Philox::ToDouble(out.v[0], out.v[1]);
+	}
+
+	void Get2D(double& u1, double& u2) override {
+		const Philox::Block out = Philox::Generate(m_seed, { { m_x, m_y, m_index, m_dimension } });
+		m_dimension += 2;
+		u1 = Philox::ToDouble(out.v[0], out.v[1]);
+		u2 = Philox::ToDouble(out.v[2], out.v[3]);
+	}
+
+private:
+	uint64_t m_seed;
+	uint32_t m_x;
+	uint32_t m_y;
+	uint32_t m_index;
+};
+
+// Owen-scrambled Sobol points with the hash-based scrambling of Burley, "Practical Hash-based
+// Owen Scrambling" (JCGT 2020). Each 1D or 2D request is its own scrambled, index-shuffled
+// (0, 2)-sequence seeded by its dimension, which pads the first two Sobol dimensions to any
+// count without the correlation of higher Sobol dimensions.
+class SobolSampler : public Sampler {
+public:
+	explicit SobolSampler(uint64_t seed) : m_seed(seed), m_pixelSeed(0), m_index(0) { }
+
+	void StartSample(uint32_t x, uint32_t y, uint32_t index) override {
+		m_pixelSeed = Hash(m_seed ^ (((uint64_t)y << 32) | x));
+		m_index = index;
+		m_dimension = 0;
+	}
+
+	double Get1D() override {
+		double u1, u2;
+		Sample(m_pixelSeed, m_dimension, u1, u2);
+		++m_dimension;
+		return u1;
+	}
+
+	void Get2D(double& u1, double& u2) override {
+		Sample(m_pixelSeed, m_dimension, u1, u2);
+		m_dimension += 2;
+	}
+
+protected:
+	// Point m_index of the 2D sequence for `dimension`, scrambled by `seed`.
+	void Sample(uint64_t seed, uint32_t dimension, double& u1, double& u2) const {
+		const uint64_t h = Hash(seed ^ ((uint64_t)dimension << 32));
+		const uint32_t index = NestedUniformScramble(m_index, (uint32_t)h);
+		// The first dimension is ReverseBits(index), so scrambling it needs only one reversal.
+		const uint32_t x = ReverseBits(LaineKarrasPermutation(index, (uint32_t)(h >> 32)));
+		const uint32_t y = NestedUniformScramble(SobolSecond(index), (uint32_t)((h * 0x9e3779b97f4a7c15ull) >> 32));
+		u1 = x * (1.0 / 4294967296.0);
+		u2 = y * (1.0 / 4294967296.0);
+	}
+
+	static uint64_t Hash(uint64_t z) {
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+
+	uint64_t m_seed;
+	uint64_t m_pixelSeed;
+	uint32_t m_index;
+
+private:
+	static uint32_t ReverseBits(uint32_t x) {
+		x = ((x & 0x55555555u) << 1) | ((x >> 1) & 0x55555555u);
+		x = ((x & 0x33333333u) << 2) | ((x >> 2) & 0x33333333u);
+		x = ((x & 0x0f0f0f0fu) << 4) | ((x >> 4) & 0x0f0f0f0fu);
+		x = ((x & 0x00ff00ffu) << 8) | ((x >> 8) & 0x00ff00ffu);
+		return (x << 16) | (x >> 16);
+	}
+
+	// Second Sobol dimension; its generator matrix is Pascal's triangle mod 2. The shuffled
+	// indices use all 32 bits, so the matrix product is done a byte at a time from tables.
+	static uint32_t SobolSecond(uint32_t index) {
+		struct Tables {
+			uint32_t bytes[4][256];
+
+			Tables() {
+				uint32_t v[32];
+				v[0] = 1u << 31;
+				for (int k = 1; k < 32; ++k) {
+					v[k] = v[k - 1] ^ (v[k - 1] >> 1);
+				}
+				for (int b = 0; b < 4; ++b) {
+					for (uint32_t value = 0; value < 256; ++value) {
+						uint32_t result = 0;
+						for (int bit = 0; bit < 8; ++bit) {
+							if (value & (1u << bit)) {
+								result ^= v[8 * b + bit];
+							}
+						}
+						bytes[b][value] = result;
+					}
+				}
+			}
+		};
+		static const Tables tables;
+		return tables.bytes[0][index & 0xff] ^ tables.bytes[1][(index >> 8) & 0xff]
+			^ tables.bytes[2][(index >> 16) & 0xff] ^ tables.bytes[3][index >> 24];
+	}
+
+	static uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed) {
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return x;
+	}
+
+	static uint32_t NestedUniformScramble(uint32_t x, uint32_t seed) {
+		return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+	}
+};
+
+// Blue-noise dithered sampling (Georgiev & Fajardo, 2016): every pixel walks the same scrambled
+// Sobol sequence, shifted toroidally by a blue-noise texture value. Neighbouring pixels then
+// get well spread offsets, so what error is left looks like high-frequency noise instead of
+// blotches. Each dimension reads the texture at a different offset to stay uncorrelated.
+class BlueNoiseSampler final : public SobolSampler {
+public:
+	explicit BlueNoiseSampler(uint64_t seed) : SobolSampler(seed), m_noise(BlueNoise::Get()), m_x(0), m_y(0) { }
+
+	void StartSample(uint32_t x, uint32_t y, uint32_t index) override {
+		m_x = x;
+		m_y = y;
+		m_index = index;
+		m_dimension = 0;
+	}
+
+	double Get1D() override {
+		double u1, u2;
+		Sample(m_seed, m_dimension, u1, u2);
+		u1 = Shift(u1, m_dimension);
+		++m_dimension;
+		return u1;
+	}
+
+	void Get2D(double& u1, double& u2) override {
+		Sample(m_seed, m_dimension, u1, u2);
+		u1 = Shift(u1, m_dimension);
+		u2 = Shift(u2, m_dimension + 1);
+		m_dimension += 2;
+	}
+
+private:
+	double Shift(double u, uint32_t dimension) const {
+		const uint64_t h = Hash(m_seed + dimension);
+		u += m_noise.At(m_x + (uint32_t)h, m_y + (uint32_t)(h >> 32));
+		return u < 1.0 ? u : u - 1.0;
+	}
+
+	const BlueNoise& m_noise;
+	uint32_t m_x;
+	uint32_t m_y;
+};
+
+inline std::unique_ptr<Sampler> Sampler::Create(SamplerType type, uint64_t seed) {
+	switch (type) {
+	case SamplerType::Independent:
+		return std::make_unique<IndependentSampler>(seed);
+	case SamplerType::BlueNoise:
+		return std::make_unique<BlueNoiseSampler>(seed);
+	default:
+		return std::make_unique<SobolSampler>(seed);
+	}
+}
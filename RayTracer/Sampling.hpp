@@ -0,0 +1,165 @@
+#pragma once
+
+#include "SamplingKernels.hpp"
+#include "SphereKernels.hpp"
+#include "Vec3.hpp"
+
+#include <cmath>
+#include <cstddef>
+
+
+// Closed-form warps from uniform numbers in [0, 1) to common domains. Every warp consumes a
+// fixed number of dimensions and never loops, so stratified or low-discrepancy inputs keep their
+// structure and a path always draws the same count of numbers per bounce.
+//
+// All of them are built on the concentric disk map (Shirley & Chiu), whose only trigonometry is
+// over [-pi/4, pi/4], short enough for a polynomial that the batched versions evaluate identically.
+
+// sin and cos for |x| <= pi/4. Taylor series, error around 1e-14 over that range.
+inline void sincos_quarter(double x, double& s, double& c) {
+	const double x2 = x * x;
+	s = x * (1.0 + x2 * (-1.0 / 6 + x2 * (1.0 / 120 + x2 * (-1.0 / 5040 + x2 * (1.0 / 362880
+		+ x2 * (-1.0 / 39916800 + x2 * (1.0 / 6227020800.0)))))));
+	c = 1.0 + x2 * (-0.5 + x2 * (1.0 / 24 + x2 * (-1.0 / 720 + x2 * (1.0 / 40320
+		+ x2 * (-1.0 / 3628800 + x2 * (1.0 / 479001600.0 + x2 * (-1.0 / 87178291200.0)))))));
+}
+
+// Uniform point in the unit disk (z = 0), area preserving and with low distortion. 2 dimensions.
+inline Vec3 sample_concentric_disk(double u1, double u2) {
+	const double quarterPi = 0.78539816339744830962;
+	const double a = 2.0 * u1 - 1.0;
+	const double b = 2.0 * u2 - 1.0;
+
+	// Pick the wedge by the larger coordinate; the ratio of the other one is the angle within it.
+	const bool useA = fabs(a) > fabs(b);
+	const double r = useA ? a : b;
+	const double q = r != 0.0 ? (useA ? b : a) / r : 0.0;
+
+	double s, c;
+	sincos_quarter(quarterPi * q, s, c);
+	return useA ? Vec3(r * c, r * s, 0.0) : Vec3(r * s, r * c, 0.0);
+}
+
+// Uniform direction on the unit sphere. 2 dimensions.
+inline Vec3 sample_uniform_sphere(double u1, double u2) {
+	// Lift the disk to the sphere with an equal-area map: z = 1 - 2r^2.
+	const Vec3 d = sample_concentric_disk(u1, u2);
+	const double rsq = d.x * d.x + d.y * d.y;
+	const double scale = 2.0 * sqrt(fmax(0.0, 1.0 - rsq));
+	return Vec3(d.x * scale, d.y * scale, 1.0 - 2.0 * rsq);
+}
+
+// Cosine-weighted direction on the hemisphere around +z (Malley's method). 2 dimensions.
+inline Vec3 sample_cosine_hemisphere(double u1, double u2) {
+	const Vec3 d = sample_concentric_disk(u1, u2);
+	return Vec3(d.x, d.y, sqrt(fmax(0.0, 1.0 - d.x * d.x - d.y * d.y)));
+}
+
+// Direction around +z with density proportional to cos^exponent (a Phong lobe). 2 dimensions.
+inline Vec3 sample_power_cosine(double u1, double u2, double exponent) {
+	// The disk gives the azimuth, and its squared radius is an independent uniform for the elevation.
+	const Vec3 d = sample_concentric_disk(u1, u2);
+	const double rsq = d.x * d.x + d.y * d.y;
+	const double z = pow(1.0 - rsq, 1.0 / (exponent + 1.0));
+	const double scale = rsq > 0.0 ? sqrt(fmax(0.0, 1.0 - z * z) / rsq) : 0.0;
+	return Vec3(d.x * scale, d.y * scale, z);
+}
+
+// Uniform direction in the cone around +z with cos(theta) >= cosThetaMax, e.g. the directions
+// towards a sphere seen from outside. 2 dimensions.
+inline Vec3 sample_uniform_cone(double u1, double u2, double cosThetaMax) {
+	const Vec3 d = sample_concentric_disk(u1, u2);
+	const double rsq = d.x * d.x + d.y * d.y;
+	const double z = 1.0 - rsq * (1.0 - cosThetaMax);
+	const double scale = rsq > 0.0 ? sqrt(fmax(0.0, 1.0 - z * z) / rsq) : 0.0;
+	return Vec3(d.x * scale, d.y * scale, z);
+}
+
+// Uniform point in the unit ball. 3 dimensions.
+inline Vec3 sample_uniform_ball(double u1, double u2, double u3) {
+	return cbrt(u3) * sample_uniform_sphere(u1, u2);
+}
+
+inline double uniform_sphere_pdf() {
+	return 0.07957747154594766788; // 1 / (4 pi)
+}
+
+inline double cosine_hemisphere_pdf(double cosTheta) {
+	return cosTheta > 0.0 ? cosTheta * 0.31830988618379067154 : 0.0; // cos / pi
+}
+
+inline double power_cosine_pdf(double cosTheta, double exponent) {
+	return cosTheta > 0.0 ? (exponent + 1.0) * 0.15915494309189533577 * pow(cosTheta, exponent) : 0.0; // (n + 1) / (2 pi)
+}
+
+inline double uniform_cone_pdf(double cosThetaMax) {
+	return 0.15915494309189533577 / (1.0 - cosThetaMax); // 1 / (2 pi (1 - cos))
+}
+
+// Rotates a direction sampled around +z so that +z maps onto the unit vector n.
+// Branchless orthonormal basis of Duff et al., "Building an Orthonormal Basis, Revisited".
+inline Vec3 to_frame(const Vec3& local, const Vec3& n) {
+	const double sign = copysign(1.0, n.z);
+	const double a = -1.0 / (sign + n.z);
+	const double b = n.x * n.y * a;
+	const Vec3 tangent(1.0 + sign * n.x * n.x * a, sign * b, -sign * n.x);
+	const Vec3 bitangent(b, sign + n.y * n.y * a, -n.y);
+	return local.x * tangent + local.y * bitangent + local.z * n;
+}
+
+// Batched forms: u1[i], u2[i] -> (x[i], y[i]) or (x[i], y[i], z[i]). Results match the scalar warps.
+// Arrays need not be aligned. On CPUs with AVX2 whole groups of four go to SamplingKernels; the
+// tail, and everything on other CPUs, takes the scalar code. The renderer draws one sample per
+// path vertex and does not use these; they are for callers that warp whole arrays at once.
+class SampleBatch {
+public:
+	static void ConcentricDisk(const double* u1, const double* u2, size_t count, double* x, double* y) {
+		size_t i = 0;
+#if defined(RT_SPHERE_KERNELS)
+		if (s_isa == SphereKernels::Isa::AVX2) {
+			i = count & ~(size_t)3;
+			SamplingKernels::ConcentricDiskAVX2(u1, u2, i, x, y);
+		}
+#endif
+		for (; i < count; ++i) {
+			const Vec3 d = sample_concentric_disk(u1[i], u2[i]);
+			x[i] = d.x;
+			y[i] = d.y;
+		}
+	}
+
+	static void UniformSphere(const double* u1, const double* u2, size_t count, double* x, double* y, double* z) {
+		size_t i = 0;
+#if defined(RT_SPHERE_KERNELS)
+		if (s_isa == SphereKernels::Isa::AVX2) {
+			i = count & ~(size_t)3;
+			SamplingKernels::UniformSphereAVX2(u1, u2, i, x, y, z);
+		}
+#endif
+		for (; i < count; ++i) {
+			const Vec3 d = sample_uniform_sphere(u1[i], u2[i]);
+			x[i] = d.x;
+			y[i] = d.y;
+			z[i] = d.z;
+		}
+	}
+
+	static void CosineHemisphere(const double* u1, const double* u2, size_t count, double* x, double* y, double* z) {
+		size_t i = 0;
+#if defined(RT_SPHERE_KERNELS)
+		if (s_isa == SphereKernels::Isa::AVX2) {
+			i = count & ~(size_t)3;
+			SamplingKernels::CosineHemisphereAVX2(u1, u2, i, x, y, z);
+		}
+#endif
+		for (; i < count; ++i) {
+			const Vec3 d = sample_cosine_hemisphere(u1[i], u2[i]);
+			x[i] = d.x;
+			y[i] = d.y;
+			z[i] = d.z;
+		}
+	}
+
+private:
+	static inline const SphereKernels::Isa s_isa = SphereKernels::Detect();
+};
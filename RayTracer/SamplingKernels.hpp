@@ -0,0 +1,15 @@
+#pragma once
+
+#include "SphereKernels.hpp"
+
+#include <cstddef>
+
+// AVX2 loops behind SampleBatch, in SamplingKernelsAVX2.cpp built with /arch:AVX2. They are kept
+// out of Sampling.hpp for the same reason the sphere kernels are, see SphereKernels.hpp.
+// `count` must be a multiple of four.
+class SamplingKernels {
+public:
+	static void ConcentricDiskAVX2(const double* u1, const double* u2, size_t count, double* x, double* y);
+	static void UniformSphereAVX2(const double* u1, const double* u2, size_t count, double* x, double* y, double* z);
+	static void CosineHemisphereAVX2(const double* u1, const double* u2, size_t count, double* x, double* y, double* z);
+};
@@ -0,0 +1,80 @@
+// Built with /arch:AVX2. SampleBatch only calls in here when the CPU has AVX2.
+#include "SamplingKernels.hpp"
+
+#if defined(RT_SPHERE_KERNELS)
+#include <immintrin.h>
+
+// Four lanes of sample_concentric_disk, operation for operation.
+static void Disk4(__m256d u1, __m256d u2, __m256d& x, __m256d& y) {
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d two = _mm256_set1_pd(2.0);
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d absMask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffll));
+
+	const __m256d a = _mm256_sub_pd(_mm256_mul_pd(two, u1), one);
+	const __m256d b = _mm256_sub_pd(_mm256_mul_pd(two, u2), one);
+	const __m256d useA = _mm256_cmp_pd(_mm256_and_pd(a, absMask), _mm256_and_pd(b, absMask), _CMP_GT_OQ);
+	const __m256d r = _mm256_blendv_pd(b, a, useA);
+	const __m256d other = _mm256_blendv_pd(a, b, useA);
+	const __m256d nonZero = _mm256_cmp_pd(r, zero, _CMP_NEQ_UQ);
+	const __m256d q = _mm256_and_pd(_mm256_div_pd(other, r), nonZero);
+
+	const __m256d t = _mm256_mul_pd(_mm256_set1_pd(0.78539816339744830962), q);
+	const __m256d t2 = _mm256_mul_pd(t, t);
+	__m256d s = _mm256_set1_pd(1.0 / 6227020800.0);
+	s = _mm256_add_pd(_mm256_set1_pd(-1.0 / 39916800), _mm256_mul_pd(t2, s));
+	s = _mm256_add_pd(_mm256_set1_pd(1.0 / 362880), _mm256_mul_pd(t2, s));
+	s = _mm256_add_pd(_mm256_set1_pd(-1.0 / 5040), _mm256_mul_pd(t2, s));
+	s = _mm256_add_pd(_mm256_set1_pd(1.0 / 120), _mm256_mul_pd(t2, s));
+	s = _mm256_add_pd(_mm256_set1_pd(-1.0 / 6), _mm256_mul_pd(t2, s));
+	s = _mm256_mul_pd(t, _mm256_add_pd(one, _mm256_mul_pd(t2, s)));
+	__m256d c = _mm256_set1_pd(-1.0 / 87178291200.0);
+	c = _mm256_add_pd(_mm256_set1_pd(1.0 / 479001600.0), _mm256_mul_pd(t2, c));
+	c = _mm256_add_pd(_mm256_set1_pd(-1.0 / 3628800), _mm256_mul_pd(t2, c));
+	c = _mm256_add_pd(_mm256_set1_pd(1.0 / 40320), _mm256_mul_pd(t2, c));
+	c = _mm256_add_pd(_mm256_set1_pd(-1.0 / 720), _mm256_mul_pd(t2, c));
+	c = _mm256_add_pd(_mm256_set1_pd(1.0 / 24), _mm256_mul_pd(t2, c));
+	c = _mm256_add_pd(_mm256_set1_pd(-0.5), _mm256_mul_pd(t2, c));
+	c = _mm256_add_pd(one, _mm256_mul_pd(t2, c));
+
+	x = _mm256_mul_pd(r, _mm256_blendv_pd(s, c, useA));
+	y = _mm256_mul_pd(r, _mm256_blendv_pd(c, s, useA));
+}
+
+void SamplingKernels::ConcentricDiskAVX2(const double* u1, const double* u2, size_t count, double* x, double* y) {
+	for (size_t i = 0; i < count; i += 4) {
+		__m256d dx, dy;
+		Disk4(_mm256_loadu_pd(u1 + i), _mm256_loadu_pd(u2 + i), dx, dy);
+		_mm256_storeu_pd(x + i, dx);
+		_mm256_storeu_pd(y + i, dy);
+	}
+}
+
+void SamplingKernels::UniformSphereAVX2(const double* u1, const double* u2, size_t count, double* x, double* y, double* z) {
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d two = _mm256_set1_pd(2.0);
+	for (size_t i = 0; i < count; i += 4) {
+		__m256d dx, dy;
+		Disk4(_mm256_loadu_pd(u1 + i), _mm256_loadu_pd(u2 + i), dx, dy);
+		const __m256d rsq = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+		const __m256d scale = _mm256_mul_pd(two, _mm256_sqrt_pd(_mm256_max_pd(zero, _mm256_sub_pd(one, rsq))));
+		_mm256_storeu_pd(x + i, _mm256_mul_pd(dx, scale));
+		_mm256_storeu_pd(y + i, _mm256_mul_pd(dy, scale));
+		_mm256_storeu_pd(z + i, _mm256_sub_pd(one, _mm256_mul_pd(two, rsq)));
+	}
+}
+
+void SamplingKernels::CosineHemisphereAVX2(const double* u1, const double* u2, size_t count, double* x, double* y, double* z) {
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d one = _mm256_set1_pd(1.0);
+	for (size_t i = 0; i < count; i += 4) {
+		__m256d dx, dy;
+		Disk4(_mm256_loadu_pd(u1 + i), _mm256_loadu_pd(u2 + i), dx, dy);
+		const __m256d rest = _mm256_sub_pd(_mm256_sub_pd(one, _mm256_mul_pd(dx, dx)), _mm256_mul_pd(dy, dy));
+		_mm256_storeu_pd(x + i, dx);
+		_mm256_storeu_pd(y + i, dy);
+		_mm256_storeu_pd(z + i, _mm256_sqrt_pd(_mm256_max_pd(zero, rest)));
+	}
+}
+#endif
@@ -0,0 +1,308 @@
+#pragma once
+
+#include "AtomicFile.hpp"
+#include "MappedFile.hpp"
+#include "SceneFile.hpp"
+#include "World.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Binary snapshot of a loaded and built scene file: the settings, the material table, the
+// spheres in BVH leaf order and the BVH itself, as flat arrays in host layout. Loading maps the
+// file and points the World straight at those arrays, so nothing is parsed or rebuilt.
+//
+// A cache belongs to the scene file whose content hash it records. If the scene file's size
+// and modification time still match, it is trusted without reading the scene; otherwise the
+// scene is hashed again and the cache is only used when the contents are unchanged.
+class SceneCache {
+public:
+	// Writes `world`, which must have been built with a BVH from `scene`, loaded from `sourcePath`.
+	static bool Write(const std::string& path, const std::string& sourcePath, const SceneFile& scene, const World& world) {
+		const BVH& bvh = world.GetBVH();
+		// Meshes and instances are not cached; their OBJ files are loaded again instead.
+		if (!world.IsBuilt() || world.GetAccelMode() != World::AccelMode::BVH || bvh.Empty() || world.MeshCount() > 0
+			|| !world.Instances().Empty()) {
+			return false;
+		}
+
+		std::vector<MaterialRecord> materials(world.MaterialCount());
+		for (MaterialId id = 0; id < materials.size(); ++id) {
+			if (!MakeRecord(world.GetMaterial(id), materials[id])) {
+				return false;
+			}
+		}
+
+		const SphereSet& spheres = world.Spheres();
+		const SceneFile::Options& options = scene.GetOptions();
+		SettingsRecord settings = {};
+		settings.width = options.width;
+		settings.height = options.height;
+		settings.samples = options.samples;
+		settings.minSamples = options.minSamples;
+		settings.maxDepth = options.maxDepth;
+		settings.hasBackground = options.background.has_value();
+		settings.targetError = options.targetError;
+		settings.background = options.background.value_or(Color());
+		settings.camera = scene.GetCamera();
+		settings.sourceBytes = scene.ByteCount();
+		settings.outputLength = options.output.size();
+
+		Header header = {};
+		header.magic = MAGIC;
+		header.version = VERSION;
+		header.nodeSize = sizeof(BVH::Node);
+		header.contentHash = scene.ContentHash();
+		if (!SourceStamp(sourcePath, header.sourceSize, header.sourceTime)) {
+			return false;
+		}
+		header.sphereCount = spheres.Size();
+		header.materialCount = materials.size();
+		header.lightCount = world.Lights().size();
+		header.nodeCount = bvh.NodeCount();
+
+		// Lay the sections out one after another, each aligned for direct use.
+		uint64_t offset = sizeof(Header);
+		auto place = [&offset](uint64_t bytes) {
+			offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+			const uint64_t at = offset;
+			offset += bytes;
+			return at;
+		};
+		const uint64_t sphereBytes = header.sphereCount * sizeof(double);
+		header.centerX = place(sphereBytes);
+		header.centerY = place(sphereBytes);
+		header.centerZ = place(sphereBytes);
+		header.radius = place(sphereBytes);
+		header.sphereMaterials = place(header.sphereCount * sizeof(MaterialId));
+		header.lights = place(header.lightCount * sizeof(uint32_t));
+		header.nodes = place(header.nodeCount * sizeof(BVH::Node));
+		header.materials = place(header.materialCount * sizeof(MaterialRecord));
+		header.settings = place(sizeof(SettingsRecord) + settings.outputLength);
+		header.fileSize = offset;
+
+		AtomicFile file(path);
+		auto section = [&file](uint64_t at, const void* data, uint64_t bytes) {
+			static const char padding[ALIGNMENT] = {};
+			return file.Write(padding, (size_t)(at - file.Position())) && file.Write(data, (size_t)bytes);
+		};
+		return file.Write(&header, sizeof(header))
+			&& section(header.centerX, spheres.CenterX(), sphereBytes)
+			&& section(header.centerY, spheres.CenterY(), sphereBytes)
+			&& section(header.centerZ, spheres.CenterZ(), sphereBytes)
+			&& section(header.radius, spheres.Radii(), sphereBytes)
+			&& section(header.sphereMaterials, world.SphereMaterials().data(), header.sphereCount * sizeof(MaterialId))
+			&& section(header.lights, world.Lights().data(), header.lightCount * sizeof(uint32_t))
+			&& section(header.nodes, bvh.Nodes(), header.nodeCount * sizeof(BVH::Node))
+			&& section(header.materials, materials.data(), header.materialCount * sizeof(MaterialRecord))
+			&& section(header.settings, &settings, sizeof(settings))
+			&& file.Write(options.output.data(), options.output.size())
+			&& file.Commit();
+	}
+
+	// Fills `world` and `scene` from the cache at `path` if it is valid for the scene file at
+	// `sourcePath`. The world keeps the mapping open and renders straight from it.
+	static bool Load(const std::string& path, const std::string& sourcePath, SceneFile& scene, World& world) {
+		auto mapped = std::make_shared<MappedFile>();
+		if (!mapped->Open(path) || mapped->Size() < sizeof(Header)) {
+			return false;
+		}
+		const uint8_t* base = mapped->Data();
+		Header header;
+		memcpy(&header, base, sizeof(header));
+		if (header.magic != MAGIC || header.version != VERSION || header.nodeSize != sizeof(BVH::Node)
+			|| header.fileSize != mapped->Size() || !SectionsFit(header)) {
+			return false;
+		}
+
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		if (!SourceStamp(sourcePath, sourceSize, sourceTime)) {
+			return false;
+		}
+		if (sourceSize != header.sourceSize || sourceTime != header.sourceTime) {
+			uint64_t hash;
+			if (!SceneFile::HashFile(sourcePath, hash) || hash != header.contentHash) {
+				return false;
+			}
+		}
+
+		SettingsRecord settings;
+		memcpy(&settings, base + header.settings, sizeof(settings));
+		if (settings.outputLength > header.fileSize - header.settings - sizeof(settings)) {
+			return false;
+		}
+		SceneFile::Options options;
+		options.width = (size_t)settings.width;
+		options.height = (size_t)settings.height;
+		options.output.assign(reinterpret_cast<const char*>(base + header.settings + sizeof(settings)), (size_t)settings.outputLength);
+		options.samples = settings.samples;
+		options.minSamples = settings.minSamples;
+		options.targetError = settings.targetError;
+		options.maxDepth = settings.maxDepth;
+		if (settings.hasBackground) {
+			options.background = settings.background;
+		}
+
+		// The sections fit the file, but the render indexes with what is in them, so a damaged
+		// cache must be caught here rather than read out of bounds later.
+		const size_t count = (size_t)header.sphereCount;
+		const MaterialRecord* materials = reinterpret_cast<const MaterialRecord*>(base + header.materials);
+		auto sphereMaterials = FlatArray<MaterialId>::View(reinterpret_cast<const MaterialId*>(base + header.sphereMaterials), count);
+		auto lights = FlatArray<uint32_t>::View(reinterpret_cast<const uint32_t*>(base + header.lights), (size_t)header.lightCount);
+		BVH bvh = BVH::View(reinterpret_cast<const BVH::Node*>(base + header.nodes), (size_t)header.nodeCount);
+		if (!ValuesInRange(header, materials, sphereMaterials, lights) || !bvh.IsWellFormed(count)) {
+			return false;
+		}
+
+		world.Clear();
+		world.Reserve(0, (size_t)header.materialCount);
+		for (uint64_t i = 0; i < header.materialCount; ++i) {
+			world.AddMaterial(MakeMaterial(materials[i]));
+		}
+
+		auto doubles = [base](uint64_t at) { return reinterpret_cast<const double*>(base + at); };
+		world.SetPrebuilt(
+			SphereSet::View(doubles(header.centerX), doubles(header.centerY), doubles(header.centerZ), doubles(header.radius), count),
+			std::move(sphereMaterials), std::move(lights), std::move(bvh), mapped);
+		scene.Restore(options, settings.camera, header.contentHash ^ settings.sourceBytes, settings.sourceBytes);
+		return true;
+	}
+
+private:
+	static constexpr uint32_t MAGIC = 0x43535452; // "RTSC"
+	static constexpr uint32_t VERSION = 1;
+	static constexpr uint64_t ALIGNMENT = 64;
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t nodeSize;
+		uint32_t reserved;
+		uint64_t contentHash;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint64_t sphereCount;
+		uint64_t materialCount;
+		uint64_t lightCount;
+		uint64_t nodeCount;
+		// Byte offsets of the sections from the start of the file.
+		uint64_t centerX;
+		uint64_t centerY;
+		uint64_t centerZ;
+		uint64_t radius;
+		uint64_t sphereMaterials;
+		uint64_t lights;
+		uint64_t nodes;
+		uint64_t materials;
+		uint64_t settings;
+		uint64_t fileSize;
+	};
+
+	// A built-in material by its parameters; `value` is the fuzz or the index of refraction.
+	struct MaterialRecord {
+		uint32_t type;
+		uint32_t reserved;
+		double value;
+		Color color;
+	};
+
+	// SceneFile::Options and camera, followed in the file by the output name.
+	struct SettingsRecord {
+		uint64_t width;
+		uint64_t height;
+		int32_t samples;
+		int32_t minSamples;
+		int32_t maxDepth;
+		int32_t hasBackground;
+		double targetError;
+		Color background;
+		SceneFile::CameraSpec camera;
+		uint64_t sourceBytes;
+		uint64_t outputLength;
+	};
+
+	static bool MakeRecord(const AnyMaterial& material, MaterialRecord& record) {
+		record = MaterialRecord();
+		record.type = (uint32_t)material.Type();
+		if (const Lambertian* lambertian = material.As<Lambertian>()) {
+			record.color = lambertian->Albedo();
+		}
+		else if (const Metal* metal = material.As<Metal>()) {
+			record.color = metal->Albedo();
+			record.value = metal->Fuzz();
+		}
+		else if (const Dielectric* dielectric = material.As<Dielectric>()) {
+			record.value = dielectric->IndexOfRefraction();
+		}
+		else if (const DiffuseLight* light = material.As<DiffuseLight>()) {
+			record.color = light->Emit();
+		}
+		else {
+			// Custom materials are code, not data.
+			return false;
+		}
+		return true;
+	}
+
+	static AnyMaterial MakeMaterial(const MaterialRecord& record) {
+		switch ((MaterialType)record.type) {
+		case MaterialType::Metal:
+			return Metal(record.color, (float)record.value);
+		case MaterialType::Dielectric:
+			return Dielectric(record.value);
+		case MaterialType::DiffuseLight:
+			return DiffuseLight(record.color);
+		default:
+			return Lambertian(record.color);
+		}
+	}
+
+	// Counts come from the file, so each is checked against what the file could hold before it
+	// is multiplied by its element size.
+	static bool SectionsFit(const Header& h) {
+		auto fits = [&h](uint64_t at, uint64_t count, uint64_t size) {
+			return at % sizeof(double) == 0 && at <= h.fileSize && count <= h.fileSize / size && count * size <= h.fileSize - at;
+		};
+		return fits(h.centerX, h.sphereCount, sizeof(double)) && fits(h.centerY, h.sphereCount, sizeof(double))
+			&& fits(h.centerZ, h.sphereCount, sizeof(double)) && fits(h.radius, h.sphereCount, sizeof(double))
+			&& fits(h.sphereMaterials, h.sphereCount, sizeof(MaterialId)) && fits(h.lights, h.lightCount, sizeof(uint32_t))
+			&& fits(h.nodes, h.nodeCount, sizeof(BVH::Node)) && fits(h.materials, h.materialCount, sizeof(MaterialRecord))
+			&& fits(h.settings, 1, sizeof(SettingsRecord));
+	}
+
+	static bool ValuesInRange(const Header& h, const MaterialRecord* materials, const FlatArray<MaterialId>& sphereMaterials,
+		const FlatArray<uint32_t>& lights) {
+		for (uint64_t i = 0; i < h.materialCount; ++i) {
+			if (materials[i].type >= (uint32_t)MaterialType::Custom) {
+				return false;
+			}
+		}
+		for (MaterialId id : sphereMaterials) {
+			if (id >= h.materialCount) {
+				return false;
+			}
+		}
+		for (uint32_t light : lights) {
+			if (light >= h.sphereCount) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static bool SourceStamp(const std::string& path, uint64_t& size, int64_t& time) {
+		std::error_code ec;
+		size = std::filesystem::file_size(path, ec);
+		if (ec) {
+			return false;
+		}
+		time = (int64_t)std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+		return !ec;
+	}
+};
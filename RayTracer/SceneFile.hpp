@@ -0,0 +1,444 @@
+#pragma once
+
+#include "Camera.hpp"
+#include "ObjLoader.hpp"
+#include "World.hpp"
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Loader for plain-text scene files. One statement per line, fields separated by spaces or tabs,
+// '#' starts a comment. Materials must be defined before the spheres that use them.
+//
+//   output <width> <height> [<file.bmp>]
+//   samples <max> [<min> <target error>]
+//   maxdepth <depth>
+//   background <r> <g> <b>                        (default: the sky gradient)
+//   camera <from xyz> <at xyz> <up xyz> <vfov> [<aperture> [<focus distance>]]
+//   material <name> lambertian <r> <g> <b>
+//   material <name> metal <r> <g> <b> <fuzz>
+//   material <name> dielectric <index of refraction>
+//   material <name> light <r> <g> <b>
+//   spheres <count>                               (optional, reserves storage)
+//   sphere <x> <y> <z> <radius> <material>
+//   mesh <file.obj> <material>                    (path relative to the scene file)
+//   object <name> <file.obj> <material>           (a mesh placed only by instance)
+//   instance <object> <x> <y> <z> [<degrees about y> [<scale>]]
+//
+// The file is read in fixed-size chunks and parsed in place, so a scene with millions of spheres
+// needs no memory beyond the World it fills. Meshes are loaded by ObjLoader; an object is loaded
+// once however many instances place it.
+class SceneFile {
+public:
+	// Settings the file may give. Anything left unset keeps the renderer's own value.
+	struct Options {
+		size_t width = 0;
+		size_t height = 0;
+		std::string output;
+		int samples = 0;
+		int minSamples = 0;
+		double targetError = 0.0;
+		int maxDepth = 0;
+		std::optional<Color> background;
+	};
+
+	struct CameraSpec {
+		Point lookfrom = Point(0.0, 0.0, 0.0);
+		Point lookat = Point(0.0, 0.0, -1.0);
+		Vec3 up = Vec3(0.0, 1.0, 0.0);
+		double vfov = 90.0;
+		double aperture = 0.0;
+		// Zero focuses on lookat.
+		double focusDistance = 0.0;
+	};
+
+	SceneFile() : m_options(), m_camera(), m_hash(0), m_bytes(0), m_line(0), m_directory(), m_materialIds(), m_objectIds(), m_key(),
+		m_pool(nullptr) { }
+
+	// Fills `world` from the file at `path`, building meshes at the world's build quality on the
+	// threads of `pool` if given. On failure `error` says where and why.
+	bool Load(const std::string& path, World& world, std::string& error, ThreadPool* pool = nullptr) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			error = path + ": cannot open file";
+			return false;
+		}
+
+		m_options = Options();
+		m_camera = CameraSpec();
+		m_hash = HASH_SEED;
+		m_bytes = 0;
+		m_line = 0;
+		m_directory = std::filesystem::path(path).parent_path();
+		m_materialIds.clear();
+		m_objectIds.clear();
+		m_pool = pool;
+
+		// Each read appends exactly CHUNK_SIZE bytes after the unfinished line carried over
+		// from the previous chunk, so the hash does not depend on where lines fall.
+		std::vector<char> buffer(CHUNK_SIZE);
+		size_t carried = 0;
+		for (;;) {
+			if (buffer.size() < carried + CHUNK_SIZE) {
+				buffer.resize(carried + CHUNK_SIZE);
+			}
+			file.read(buffer.data() + carried, CHUNK_SIZE);
+			const size_t got = (size_t)file.gcount();
+			m_hash = hash_bytes(m_hash, buffer.data() + carried, got);
+			m_bytes += got;
+
+			const char* begin = buffer.data();
+			const char* end = begin + carried + got;
+			const bool last = got < CHUNK_SIZE;
+			while (begin < end) {
+				const char* newline = static_cast<const char*>(memchr(begin, '\n', end - begin));
+				if (!newline && !last) {
+					break;
+				}
+				const char* lineEnd = newline ? newline : end;
+				++m_line;
+				if (!ParseLine(begin, lineEnd, world, error)) {
+					error = path + ":" + std::to_string(m_line) + ": " + error;
+					return false;
+				}
+				begin = newline ? newline + 1 : end;
+			}
+			if (last) {
+				break;
+			}
+			carried = end - begin;
+			memmove(buffer.data(), begin, carried);
+		}
+		return true;
+	}
+
+	const Options& GetOptions() const {
+		return m_options;
+	}
+
+	const CameraSpec& GetCamera() const {
+		return m_camera;
+	}
+
+	// Takes the result of an earlier Load() of the same file, as stored in a scene cache.
+	void Restore(const Options& options, const CameraSpec& camera, uint64_t hash, uint64_t bytes) {
+		m_options = options;
+		m_camera = camera;
+		m_hash = hash;
+		m_bytes = bytes;
+	}
+
+	Camera MakeCamera(size_t width, size_t height) const {
+		const CameraSpec& c = m_camera;
+		const double focus = c.focusDistance > 0.0 ? c.focusDistance : (c.lookat - c.lookfrom).length();
+		return Camera(width, height, c.vfov, c.lookfrom, c.lookat, c.up, focus, c.aperture);
+	}
+
+	// Hash of the file's bytes and those of the meshes it loads, to tell scenes apart without
+	// comparing them.
+	uint64_t ContentHash() const {
+		return m_hash ^ m_bytes;
+	}
+
+	// ContentHash() of the file at `path` without parsing it, for a scene without meshes.
+	static bool HashFile(const std::string& path, uint64_t& hash) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			return false;
+		}
+		std::vector<char> buffer(CHUNK_SIZE);
+		uint64_t h = HASH_SEED, bytes = 0;
+		do {
+			file.read(buffer.data(), CHUNK_SIZE);
+			const size_t got = (size_t)file.gcount();
+			h = hash_bytes(h, buffer.data(), got);
+			bytes += got;
+		} while (file);
+		hash = h ^ bytes;
+		return true;
+	}
+
+	uint64_t ByteCount() const {
+		return m_bytes;
+	}
+
+private:
+	static constexpr size_t CHUNK_SIZE = 1 << 20;
+	static constexpr uint64_t HASH_SEED = 0x7363656e6566696cull;
+
+	// Cursor over one line: hands out whitespace-separated fields and numbers.
+	class Fields {
+	public:
+		Fields(const char* begin, const char* end) : m_p(begin), m_end(end) {
+			const char* comment = static_cast<const char*>(memchr(begin, '#', end - begin));
+			if (comment) {
+				m_end = comment;
+			}
+		}
+
+		bool Done() {
+			SkipSpace();
+			return m_p == m_end;
+		}
+
+		std::string_view Next() {
+			SkipSpace();
+			const char* start = m_p;
+			while (m_p < m_end && !IsSpace(*m_p)) {
+				++m_p;
+			}
+			return std::string_view(start, m_p - start);
+		}
+
+		bool Number(double& value) {
+			SkipSpace();
+			const std::from_chars_result result = std::from_chars(m_p, m_end, value);
+			if (result.ec != std::errc() || (result.ptr < m_end && !IsSpace(*result.ptr))) {
+				return false;
+			}
+			m_p = result.ptr;
+			return true;
+		}
+
+		bool Integer(int& value) {
+			SkipSpace();
+			const std::from_chars_result result = std::from_chars(m_p, m_end, value);
+			if (result.ec != std::errc() || (result.ptr < m_end && !IsSpace(*result.ptr))) {
+				return false;
+			}
+			m_p = result.ptr;
+			return true;
+		}
+
+		bool Vector(Vec3& v) {
+			return Number(v.x) && Number(v.y) && Number(v.z);
+		}
+
+	private:
+		static bool IsSpace(char c) {
+			return c == ' ' || c == '\t' || c == '\r';
+		}
+
+		void SkipSpace() {
+			while (m_p < m_end && IsSpace(*m_p)) {
+				++m_p;
+			}
+		}
+
+		const char* m_p;
+		const char* m_end;
+	};
+
+	bool ParseLine(const char* begin, const char* end, World& world, std::string& error) {
+		Fields fields(begin, end);
+		if (fields.Done()) {
+			return true;
+		}
+		const std::string_view keyword = fields.Next();
+		bool ok;
+		if (keyword == "sphere") {
+			ok = ParseSphere(fields, world, error);
+		}
+		else if (keyword == "instance") {
+			ok = ParseInstance(fields, world, error);
+		}
+		else if (keyword == "mesh") {
+			std::shared_ptr<TriangleMesh> mesh = LoadMesh(fields, world, error);
+			ok = mesh != nullptr;
+			if (ok) {
+				world.AddMesh(std::move(mesh));
+			}
+		}
+		else if (keyword == "object") {
+			ok = ParseObject(fields, world, error);
+		}
+		else if (keyword == "material") {
+			ok = ParseMaterial(fields, world, error);
+		}
+		else if (keyword == "camera") {
+			CameraSpec& c = m_camera;
+			ok = fields.Vector(c.lookfrom) && fields.Vector(c.lookat) && fields.Vector(c.up) && fields.Number(c.vfov);
+			if (ok && !fields.Done()) {
+				ok = fields.Number(c.aperture) && (fields.Done() || fields.Number(c.focusDistance));
+			}
+		}
+		else if (keyword == "output") {
+			int width, height;
+			ok = fields.Integer(width) && fields.Integer(height) && width > 1 && height > 1;
+			if (ok) {
+				m_options.width = (size_t)width;
+				m_options.height = (size_t)height;
+				if (!fields.Done()) {
+					m_options.output = std::string(fields.Next());
+				}
+			}
+		}
+		else if (keyword == "samples") {
+			ok = fields.Integer(m_options.samples) && m_options.samples > 0;
+			if (ok && !fields.Done()) {
+				ok = fields.Integer(m_options.minSamples) && fields.Number(m_options.targetError);
+			}
+		}
+		else if (keyword == "maxdepth") {
+			ok = fields.Integer(m_options.maxDepth) && m_options.maxDepth > 0;
+		}
+		else if (keyword == "background") {
+			Color background;
+			ok = fields.Vector(background);
+			m_options.background = background;
+		}
+		else if (keyword == "spheres") {
+			int count;
+			ok = fields.Integer(count) && count >= 0;
+			if (ok) {
+				world.Reserve((size_t)count, 0);
+			}
+		}
+		else {
+			error = "unknown statement '" + std::string(keyword) + "'";
+			return false;
+		}
+
+		if (ok && !fields.Done()) {
+			error = "unexpected '" + std::string(fields.Next()) + "' after " + std::string(keyword);
+			return false;
+		}
+		if (!ok && error.empty()) {
+			error = "malformed " + std::string(keyword);
+		}
+		return ok;
+	}
+
+	bool ParseSphere(Fields& fields, World& world, std::string& error) {
+		Point center;
+		double radius;
+		if (!fields.Vector(center) || !fields.Number(radius)) {
+			return false;
+		}
+		const std::string_view name = fields.Next();
+		m_key.assign(name.data(), name.size());
+		const auto it = m_materialIds.find(m_key);
+		if (it == m_materialIds.end()) {
+			error = "unknown material '" + m_key + "'";
+			return false;
+		}
+		world.AddSphere(center, radius, it->second);
+		return true;
+	}
+
+	// <file.obj> <material>
+	std::shared_ptr<TriangleMesh> LoadMesh(Fields& fields, const World& world, std::string& error) {
+		const std::string_view file = fields.Next();
+		const std::string_view name = fields.Next();
+		if (file.empty() || name.empty()) {
+			return nullptr;
+		}
+		m_key.assign(name.data(), name.size());
+		const auto it = m_materialIds.find(m_key);
+		if (it == m_materialIds.end()) {
+			error = "unknown material '" + m_key + "'";
+			return nullptr;
+		}
+
+		uint64_t hash;
+		const std::string path = (m_directory / std::filesystem::path(file)).string();
+		std::shared_ptr<TriangleMesh> mesh = ObjLoader::Load(path, it->second, world.GetBuildQuality(), error, hash, m_pool);
+		if (mesh) {
+			m_hash = hash_bytes(m_hash, &hash, sizeof(hash));
+		}
+		return mesh;
+	}
+
+	bool ParseObject(Fields& fields, World& world, std::string& error) {
+		const std::string name(fields.Next());
+		if (name.empty()) {
+			return false;
+		}
+		std::shared_ptr<TriangleMesh> mesh = LoadMesh(fields, world, error);
+		if (!mesh) {
+			return false;
+		}
+		if (!m_objectIds.emplace(name, world.AddObject(std::move(mesh))).second) {
+			error = "object '" + name + "' is already defined";
+			return false;
+		}
+		return true;
+	}
+
+	bool ParseInstance(Fields& fields, World& world, std::string& error) {
+		const std::string_view name = fields.Next();
+		Point position;
+		double degrees = 0.0, scale = 1.0;
+		if (!fields.Vector(position) || (!fields.Done() && !fields.Number(degrees)) || (!fields.Done() && !fields.Number(scale))) {
+			return false;
+		}
+		m_key.assign(name.data(), name.size());
+		const auto it = m_objectIds.find(m_key);
+		if (it == m_objectIds.end()) {
+			error = "unknown object '" + m_key + "'";
+			return false;
+		}
+		const Transform transform = Transform::Translate(position) * Transform::Rotate(Vec3(0.0, 1.0, 0.0), degrees) * Transform::Scale(scale);
+		if (!world.AddInstance(it->second, transform)) {
+			error = "instance of '" + m_key + "' with zero scale";
+			return false;
+		}
+		return true;
+	}
+
+	bool ParseMaterial(Fields& fields, World& world, std::string& error) {
+		const std::string name(fields.Next());
+		const std::string_view type = fields.Next();
+		if (name.empty()) {
+			return false;
+		}
+
+		Color color;
+		double value;
+		std::optional<MaterialId> id;
+		if (type == "lambertian" && fields.Vector(color)) {
+			id = world.AddMaterial(Lambertian(color));
+		}
+		else if (type == "metal" && fields.Vector(color) && fields.Number(value)) {
+			id = world.AddMaterial(Metal(color, (float)value));
+		}
+		else if (type == "dielectric" && fields.Number(value)) {
+			id = world.AddMaterial(Dielectric(value));
+		}
+		else if (type == "light" && fields.Vector(color)) {
+			id = world.AddMaterial(DiffuseLight(color));
+		}
+		else {
+			error = "malformed material '" + name + "' of type '" + std::string(type) + "'";
+			return false;
+		}
+
+		if (!m_materialIds.emplace(name, *id).second) {
+			error = "material '" + name + "' is already defined";
+			return false;
+		}
+		return true;
+	}
+
+private:
+	Options m_options;
+	CameraSpec m_camera;
+	uint64_t m_hash;
+	uint64_t m_bytes;
+	size_t m_line;
+	// Mesh paths are relative to this.
+	std::filesystem::path m_directory;
+	std::unordered_map<std::string, MaterialId> m_materialIds;
+	std::unordered_map<std::string, ObjectId> m_objectIds;
+	// Reused for material lookups so spheres do not allocate.
+	std::string m_key;
+	ThreadPool* m_pool;
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of workers, each owning a deque of task indices.
+// A worker pops from the back of its own deque and, once it runs dry,
+// steals from the front of the other workers' deques.
+class ThreadPool {
+public:
+	typedef std::function<void(size_t task, size_t worker)> Task;
+
+	ThreadPool() = delete;
+
+	// The thread calling ParallelFor() acts as worker 0, so a pool of size 1 spawns no threads.
+	explicit ThreadPool(size_t threadCount) :
+		m_queues(), m_threads(), m_task(nullptr), m_pending(0), m_generation(0), m_stop(false)
+	{
+		if (threadCount == 0) {
+			threadCount = 1;
+		}
+		for (size_t i = 0; i < threadCount; ++i) {
+			m_queues.push_back(std::make_unique<WorkQueue>());
+		}
+		for (size_t i = 1; i < threadCount; ++i) {
+			m_threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (auto& thread : m_threads) {
+			thread.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t Size() const {
+		return m_queues.size();
+	}
+
+	// Runs task(i, worker) for every i in [0, count) and blocks until all of them are done.
+	void ParallelFor(size_t count, const Task& task) {
+		if (count == 0) {
+			return;
+		}
+
+		// Must be published before the first index becomes visible to a worker.
+		m_task = &task;
+		m_pending = count;
+
+		// Give every worker a contiguous block so neighbouring tasks stay on one core until stolen.
+		const size_t workers = Size();
+		for (size_t w = 0; w < workers; ++w) {
+			std::lock_guard<std::mutex> lock(m_queues[w]->lock);
+			for (size_t i = count * w / workers; i < count * (w + 1) / workers; ++i) {
+				m_queues[w]->tasks.push_back(i);
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			++m_generation;
+		}
+		m_wake.notify_all();
+
+		RunTasks(0);
+
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_done.wait(lock, [this] { return m_pending == 0; });
+	}
+
+private:
+	struct WorkQueue {
+		std::mutex lock;
+		std::deque<size_t> tasks;
+	};
+
+	void WorkerLoop(size_t worker) {
+		size_t seen = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(m_lock);
+				m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+				if (m_stop) {
+					return;
+				}
+				seen = m_generation;
+			}
+			RunTasks(worker);
+		}
+	}
+
+	void RunTasks(size_t worker) {
+		size_t index;
+		while (PopLocal(worker, index) || Steal(worker, index)) {
+			(*m_task)(index, worker);
+
+			if (m_pending.fetch_sub(1) == 1) {
+				std::lock_guard<std::mutex> lock(m_lock);
+				m_done.notify_all();
+			}
+		}
+	}
+
+	bool PopLocal(size_t worker, size_t& index) {
+		WorkQueue& queue = *m_queues[worker];
+		std::lock_guard<std::mutex> lock(queue.lock);
+		if (queue.tasks.empty()) {
+			return false;
+		}
+		index = queue.tasks.back();
+		queue.tasks.pop_back();
+		return true;
+	}
+
+	bool Steal(size_t thief, size_t& index) {
+		const size_t workers = Size();
+		for (size_t k = 1; k < workers; ++k) {
+			WorkQueue& victim = *m_queues[(thief + k) % workers];
+			std::lock_guard<std::mutex> lock(victim.lock);
+			if (!victim.tasks.empty()) {
+				index = victim.tasks.front();
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	std::vector<std::unique_ptr<WorkQueue>> m_queues;
+	std::vector<std::thread> m_threads;
+
+	std::atomic<const Task*> m_task;
+	std::atomic<size_t> m_pending;
+
+	std::mutex m_lock;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	size_t m_generation;
+	bool m_stop;
+};
+
+// Runs task(begin, end) over even slices of [0, count), spread over `pool` when there is one
+// and run in a single call otherwise.
+template <typename SliceTask>
+void ParallelSlices(ThreadPool* pool, size_t count, SliceTask&& task) {
+	const size_t slices = pool && pool->Size() > 1 ? pool->Size() * 4 : 1;
+	if (slices == 1) {
+		task((size_t)0, count);
+		return;
+	}
+	pool->ParallelFor(slices, [&](size_t s, size_t) { task(count * s / slices, count * (s + 1) / slices); });
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+
+#if !defined(RT_NO_SIMD) && (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+#define RT_SPHERE_KERNELS
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// Vector ray-sphere kernels for SphereSet. Each lives in its own source file built for its
+// instruction set (SphereKernelsSSE4.cpp, SphereKernelsAVX2.cpp with /arch:AVX2), so the rest
+// of the program stays on the baseline one and runs on any x86 CPU. SphereSet asks Detect()
+// once which of them the CPU can run.
+//
+// The kernel files only see plain arrays and this header, and call nothing here but the static
+// AcceptSphereLanes(): an inline function shared with the rest of the program and compiled
+// for AVX2 there could be the copy the linker keeps.
+class SphereKernels {
+public:
+	enum class Isa {
+		Scalar,
+		SSE4,
+		AVX2
+	};
+
+	struct Spheres {
+		const double* cx;
+		const double* cy;
+		const double* cz;
+		const double* radius;
+	};
+
+	struct Ray {
+		double ox, oy, oz;
+		double dx, dy, dz;
+	};
+
+	// Same contract as SphereSet::Intersect and Occluded. The SSE4 kernel tests spheres in
+	// pairs and needs an even `count`; the caller tests an odd one out itself.
+	template <bool AnyHit>
+	static bool IntersectSSE4(const Ray& r, const Spheres& spheres, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim);
+	template <bool AnyHit>
+	static bool IntersectAVX2(const Ray& r, const Spheres& spheres, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim);
+
+	static Isa Detect() {
+#if defined(RT_SPHERE_KERNELS)
+		uint32_t info[4];
+		Cpuid(0, info);
+		const uint32_t maxLeaf = info[0];
+		Cpuid(1, info);
+		const bool sse41 = info[2] & (1u << 19);
+		// AVX needs the OS to save the upper register halves too, which XGETBV reports.
+		const bool avx = (info[2] & (1u << 27)) && (info[2] & (1u << 28)) && (ReadXcr0() & 6) == 6;
+		if (avx && maxLeaf >= 7) {
+			Cpuid(7, info);
+			if (info[1] & (1u << 5)) {
+				return Isa::AVX2;
+			}
+		}
+		if (sse41) {
+			return Isa::SSE4;
+		}
+#endif
+		return Isa::Scalar;
+	}
+
+	static const char* Name(Isa isa) {
+		switch (isa) {
+		case Isa::AVX2:
+			return "avx2";
+		case Isa::SSE4:
+			return "sse4";
+		default:
+			return "scalar";
+		}
+	}
+
+private:
+#if defined(RT_SPHERE_KERNELS)
+	static void Cpuid(uint32_t leaf, uint32_t info[4]) {
+#if defined(_MSC_VER)
+		int regs[4];
+		__cpuidex(regs, (int)leaf, 0);
+		for (int i = 0; i < 4; ++i) {
+			info[i] = (uint32_t)regs[i];
+		}
+#else
+		__cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+#endif
+	}
+
+	static uint64_t ReadXcr0() {
+#if defined(_MSC_VER)
+		return _xgetbv(0);
+#else
+		uint32_t lo, hi;
+		__asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		return ((uint64_t)hi << 32) | lo;
+#endif
+	}
+#endif
+};
+
+// Lanes are tested against the `closest` from before the batch and then accepted in order,
+// which matches the scalar loop: a root rejected against the tighter bound is always rejected
+// later, and the far root is never closer than the near one. Static, so that each kernel file
+// keeps its own copy built for its own instruction set.
+static inline bool AcceptSphereLanes(const double* t, int mask, uint32_t base, int lanes, double& closest, uint32_t& prim) {
+	bool hit = false;
+	for (int lane = 0; lane < lanes; ++lane) {
+		if ((mask & (1 << lane)) && !(closest < t[lane])) {
+			closest = t[lane];
+			prim = base + lane;
+			hit = true;
+		}
+	}
+	return hit;
+}
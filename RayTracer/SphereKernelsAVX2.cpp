@@ -0,0 +1,75 @@
+// Built with /arch:AVX2. SphereSet only calls in here when the CPU has AVX2.
+#include "SphereKernels.hpp"
+
+#if defined(RT_SPHERE_KERNELS)
+#include <immintrin.h>
+
+template <bool AnyHit>
+bool SphereKernels::IntersectAVX2(const Ray& r, const Spheres& spheres, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim) {
+	const __m256d ox = _mm256_set1_pd(r.ox);
+	const __m256d oy = _mm256_set1_pd(r.oy);
+	const __m256d oz = _mm256_set1_pd(r.oz);
+	const __m256d dx = _mm256_set1_pd(r.dx);
+	const __m256d dy = _mm256_set1_pd(r.dy);
+	const __m256d dz = _mm256_set1_pd(r.dz);
+	const __m256d lo = _mm256_set1_pd(tmin);
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d sign = _mm256_set1_pd(-0.0);
+
+	bool hit = false;
+	const uint32_t end = first + count;
+	for (uint32_t i = first; i < end; i += 4) {
+		__m256d cx, cy, cz, rad;
+		int lanes = 4;
+		if (end - i >= 4) {
+			cx = _mm256_loadu_pd(spheres.cx + i);
+			cy = _mm256_loadu_pd(spheres.cy + i);
+			cz = _mm256_loadu_pd(spheres.cz + i);
+			rad = _mm256_loadu_pd(spheres.radius + i);
+		}
+		else {
+			// Masked loads never touch memory past the end of the arrays.
+			lanes = (int)(end - i);
+			const __m256i load = _mm256_cmpgt_epi64(_mm256_set1_epi64x(lanes), _mm256_setr_epi64x(0, 1, 2, 3));
+			cx = _mm256_maskload_pd(spheres.cx + i, load);
+			cy = _mm256_maskload_pd(spheres.cy + i, load);
+			cz = _mm256_maskload_pd(spheres.cz + i, load);
+			rad = _mm256_maskload_pd(spheres.radius + i, load);
+		}
+
+		const __m256d hi = _mm256_set1_pd(closest);
+		const __m256d ocx = _mm256_sub_pd(ox, cx);
+		const __m256d ocy = _mm256_sub_pd(oy, cy);
+		const __m256d ocz = _mm256_sub_pd(oz, cz);
+
+		const __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, ocx), _mm256_mul_pd(dy, ocy)), _mm256_mul_pd(dz, ocz));
+		const __m256d ocsq = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+		const __m256d c = _mm256_sub_pd(ocsq, _mm256_mul_pd(rad, rad));
+		const __m256d d = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), c);
+		const __m256d disc = _mm256_cmp_pd(d, zero, _CMP_GT_OQ);
+
+		const __m256d sq = _mm256_sqrt_pd(_mm256_max_pd(d, zero));
+		const __m256d neg_b = _mm256_xor_pd(half_b, sign);
+		const __m256d near_t = _mm256_sub_pd(neg_b, sq);
+		const __m256d far_t = _mm256_add_pd(neg_b, sq);
+
+		const __m256d near_ok = _mm256_and_pd(_mm256_cmp_pd(near_t, lo, _CMP_GE_OQ), _mm256_cmp_pd(near_t, hi, _CMP_LE_OQ));
+		const __m256d far_ok = _mm256_and_pd(_mm256_cmp_pd(far_t, lo, _CMP_GE_OQ), _mm256_cmp_pd(far_t, hi, _CMP_LE_OQ));
+		const __m256d t = _mm256_blendv_pd(far_t, near_t, near_ok);
+		const int mask = _mm256_movemask_pd(_mm256_and_pd(disc, _mm256_or_pd(near_ok, far_ok))) & ((1 << lanes) - 1);
+
+		if (AnyHit && mask) {
+			return true;
+		}
+		if (mask) {
+			alignas(32) double ts[4];
+			_mm256_store_pd(ts, t);
+			hit |= AcceptSphereLanes(ts, mask, i, lanes, closest, prim);
+		}
+	}
+	return hit;
+}
+
+template bool SphereKernels::IntersectAVX2<false>(const Ray& r, const Spheres& spheres, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim);
+template bool SphereKernels::IntersectAVX2<true>(const Ray& r, const Spheres& spheres, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim);
+#endif
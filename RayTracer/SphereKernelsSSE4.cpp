@@ -0,0 +1,63 @@
+// Built for the baseline instruction set: SSE4.1 intrinsics need no compiler switch, and
+// SphereSet only calls in here when the CPU has them.
+#include "SphereKernels.hpp"
+
+#if defined(RT_SPHERE_KERNELS)
+#include <smmintrin.h>
+
+template <bool AnyHit>
+bool SphereKernels::IntersectSSE4(const Ray& r, const Spheres& spheres, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim) {
+	const __m128d ox = _mm_set1_pd(r.ox);
+	const __m128d oy = _mm_set1_pd(r.oy);
+	const __m128d oz = _mm_set1_pd(r.oz);
+	const __m128d dx = _mm_set1_pd(r.dx);
+	const __m128d dy = _mm_set1_pd(r.dy);
+	const __m128d dz = _mm_set1_pd(r.dz);
+	const __m128d lo = _mm_set1_pd(tmin);
+	const __m128d zero = _mm_setzero_pd();
+	const __m128d sign = _mm_set1_pd(-0.0);
+
+	bool hit = false;
+	const uint32_t end = first + count;
+	for (uint32_t i = first; i < end; i += 2) {
+		const __m128d cx = _mm_loadu_pd(spheres.cx + i);
+		const __m128d cy = _mm_loadu_pd(spheres.cy + i);
+		const __m128d cz = _mm_loadu_pd(spheres.cz + i);
+		const __m128d rad = _mm_loadu_pd(spheres.radius + i);
+
+		const __m128d hi = _mm_set1_pd(closest);
+		const __m128d ocx = _mm_sub_pd(ox, cx);
+		const __m128d ocy = _mm_sub_pd(oy, cy);
+		const __m128d ocz = _mm_sub_pd(oz, cz);
+
+		const __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, ocx), _mm_mul_pd(dy, ocy)), _mm_mul_pd(dz, ocz));
+		const __m128d ocsq = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz));
+		const __m128d c = _mm_sub_pd(ocsq, _mm_mul_pd(rad, rad));
+		const __m128d d = _mm_sub_pd(_mm_mul_pd(half_b, half_b), c);
+		const __m128d disc = _mm_cmpgt_pd(d, zero);
+
+		const __m128d sq = _mm_sqrt_pd(_mm_max_pd(d, zero));
+		const __m128d neg_b = _mm_xor_pd(half_b, sign);
+		const __m128d near_t = _mm_sub_pd(neg_b, sq);
+		const __m128d far_t = _mm_add_pd(neg_b, sq);
+
+		const __m128d near_ok = _mm_and_pd(_mm_cmpge_pd(near_t, lo), _mm_cmple_pd(near_t, hi));
+		const __m128d far_ok = _mm_and_pd(_mm_cmpge_pd(far_t, lo), _mm_cmple_pd(far_t, hi));
+		const __m128d t = _mm_blendv_pd(far_t, near_t, near_ok);
+		const int mask = _mm_movemask_pd(_mm_and_pd(disc, _mm_or_pd(near_ok, far_ok)));
+
+		if (AnyHit && mask) {
+			return true;
+		}
+		if (mask) {
+			alignas(16) double ts[2];
+			_mm_store_pd(ts, t);
+			hit |= AcceptSphereLanes(ts, mask, i, 2, closest, prim);
+		}
+	}
+	return hit;
+}
+
+template bool SphereKernels::IntersectSSE4<false>(const Ray& r, const Spheres& spheres, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim);
+template bool SphereKernels::IntersectSSE4<true>(const Ray& r, const Spheres& spheres, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim);
+#endif
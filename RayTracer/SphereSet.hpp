@@ -0,0 +1,198 @@
+#pragma once
+
+#include "AABB.hpp"
+#include "FlatArray.hpp"
+#include "Scheduler.hpp"
+#include "SphereKernels.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+
+// Sphere centers and radii kept in separate arrays (structure of arrays), so one ray
+// can be tested against a whole batch of spheres with a single vector instruction.
+class SphereSet {
+public:
+	SphereSet() : m_cx(), m_cy(), m_cz(), m_radius() { }
+
+	// Non-owning view of `count` spheres stored elsewhere, e.g. in a mapped scene cache.
+	static SphereSet View(const double* cx, const double* cy, const double* cz, const double* radius, size_t count) {
+		SphereSet set;
+		set.m_cx = FlatArray<double>::View(cx, count);
+		set.m_cy = FlatArray<double>::View(cy, count);
+		set.m_cz = FlatArray<double>::View(cz, count);
+		set.m_radius = FlatArray<double>::View(radius, count);
+		return set;
+	}
+
+	uint32_t Add(const Point& center, double radius) {
+		m_cx.push_back(center.x);
+		m_cy.push_back(center.y);
+		m_cz.push_back(center.z);
+		m_radius.push_back(radius);
+		return (uint32_t)(m_radius.size() - 1);
+	}
+
+	void Set(uint32_t i, const Point& center, double radius) {
+		m_cx[i] = center.x;
+		m_cy[i] = center.y;
+		m_cz[i] = center.z;
+		m_radius[i] = radius;
+	}
+
+	void Reserve(size_t count) {
+		m_cx.reserve(count);
+		m_cy.reserve(count);
+		m_cz.reserve(count);
+		m_radius.reserve(count);
+	}
+
+	void Clear() {
+		m_cx.clear();
+		m_cy.clear();
+		m_cz.clear();
+		m_radius.clear();
+	}
+
+	size_t Size() const {
+		return m_radius.size();
+	}
+
+	Point Center(uint32_t i) const {
+		return Point(m_cx[i], m_cy[i], m_cz[i]);
+	}
+
+	double Radius(uint32_t i) const {
+		return m_radius[i];
+	}
+
+	// Component arrays, for writing the set out.
+	const double* CenterX() const {
+		return m_cx.data();
+	}
+
+	const double* CenterY() const {
+		return m_cy.data();
+	}
+
+	const double* CenterZ() const {
+		return m_cz.data();
+	}
+
+	const double* Radii() const {
+		return m_radius.data();
+	}
+
+	AABB Bounds(uint32_t i) const {
+		// Hollow spheres are modelled with a negative radius.
+		const double r = fabs(m_radius[i]);
+		return AABB(Center(i) - Vec3(r, r, r), Center(i) + Vec3(r, r, r));
+	}
+
+	// Instruction set of the kernel Intersect() and Occluded() run on this CPU.
+	static const char* KernelName() {
+		return SphereKernels::Name(s_isa);
+	}
+
+	// Permutes the spheres so that the new sphere i is the old sphere order[i].
+	void Reorder(const FlatArray<uint32_t>& order, ThreadPool* pool = nullptr) {
+		Permute(m_cx, order, pool);
+		Permute(m_cy, order, pool);
+		Permute(m_cz, order, pool);
+		Permute(m_radius, order, pool);
+	}
+
+	// Finds the closest sphere in [first, first + count) hit within [tmin, closest].
+	// On a hit `closest` becomes its distance and `prim` its index. When several spheres share
+	// the nearest distance the last one wins, exactly like testing them one at a time.
+	bool Intersect(const Ray& r, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim) const {
+		return Dispatch<false>(r, first, count, tmin, closest, prim);
+	}
+
+	// Any-hit variant for shadow rays: true as soon as any sphere is hit within [tmin, tmax].
+	bool Occluded(const Ray& r, uint32_t first, uint32_t count, double tmin, double tmax) const {
+		uint32_t prim = 0;
+		return Dispatch<true>(r, first, count, tmin, tmax, prim);
+	}
+
+	// Reference implementation, the same arithmetic as Sphere::Intersect. With AnyHit this and the
+	// vector kernels return on the first accepted sphere, leaving `closest` and `prim` unspecified.
+	template <bool AnyHit = false>
+	bool IntersectScalar(const Ray& r, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim) const {
+		bool hit = false;
+		for (uint32_t i = first; i < first + count; ++i) {
+			auto oc = r.origin() - Center(i);
+			auto half_b = dot(r.direction(), oc);
+			auto c = oc.lengthsq() - m_radius[i] * m_radius[i];
+
+			auto d = half_b * half_b - c;
+			if (!(d > 0)) {
+				continue;
+			}
+
+			auto root = -half_b - sqrt(d);
+			if (root < tmin || closest < root) {
+				root = -half_b + sqrt(d);
+				if (root < tmin || closest < root) {
+					continue;
+				}
+			}
+			if (AnyHit) {
+				return true;
+			}
+			closest = root;
+			prim = i;
+			hit = true;
+		}
+		return hit;
+	}
+
+private:
+	template <bool AnyHit>
+	bool Dispatch(const Ray& r, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim) const {
+#if defined(RT_SPHERE_KERNELS)
+		if (s_isa != SphereKernels::Isa::Scalar) {
+			const SphereKernels::Ray ray = { r.origin().x, r.origin().y, r.origin().z, r.direction().x, r.direction().y, r.direction().z };
+			const SphereKernels::Spheres spheres = { m_cx.data(), m_cy.data(), m_cz.data(), m_radius.data() };
+			if (s_isa == SphereKernels::Isa::AVX2) {
+				return SphereKernels::IntersectAVX2<AnyHit>(ray, spheres, first, count, tmin, closest, prim);
+			}
+			const uint32_t pairs = count & ~1u;
+			bool hit = SphereKernels::IntersectSSE4<AnyHit>(ray, spheres, first, pairs, tmin, closest, prim);
+			if (AnyHit && hit) {
+				return true;
+			}
+			if (pairs < count) {
+				hit |= IntersectScalar<AnyHit>(r, first + pairs, 1, tmin, closest, prim);
+			}
+			return hit;
+		}
+#endif
+		return IntersectScalar<AnyHit>(r, first, count, tmin, closest, prim);
+	}
+
+	template <typename T>
+	static void Permute(FlatArray<T>& values, const FlatArray<uint32_t>& order, ThreadPool* pool) {
+		// Read through a const reference so a view is not copied before being replaced.
+		const FlatArray<T>& in = values;
+		FlatArray<T> out;
+		out.resize(order.size());
+		T* dst = out.begin();
+		ParallelSlices(pool, order.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				dst[i] = in[order[i]];
+			}
+		});
+		values.swap(out);
+	}
+
+private:
+	// Kernel picked for this CPU when the program starts.
+	static inline const SphereKernels::Isa s_isa = SphereKernels::Detect();
+
+	FlatArray<double> m_cx;
+	FlatArray<double> m_cy;
+	FlatArray<double> m_cz;
+	FlatArray<double> m_radius;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "AABB.hpp"
+#include "Utils.hpp"
+
+#include <cmath>
+
+// Affine transform p' = L p + t, stored as the 3x4 matrix [L | t].
+class Transform {
+public:
+	Transform() : m_rows{ { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } } { }
+
+	static Transform Translate(const Vec3& offset) {
+		Transform t;
+		t.m_rows[0][3] = offset.x;
+		t.m_rows[1][3] = offset.y;
+		t.m_rows[2][3] = offset.z;
+		return t;
+	}
+
+	static Transform Scale(double factor) {
+		Transform t;
+		t.m_rows[0][0] = t.m_rows[1][1] = t.m_rows[2][2] = factor;
+		return t;
+	}
+
+	// Counter-clockwise about `axis` when looking down it.
+	static Transform Rotate(const Vec3& axis, double degrees) {
+		const Vec3 a = axis.unit();
+		const double s = sin(degrees_to_radians(degrees));
+		const double c = cos(degrees_to_radians(degrees));
+		Transform t;
+		t.m_rows[0][0] = a.x * a.x * (1 - c) + c;
+		t.m_rows[0][1] = a.x * a.y * (1 - c) - a.z * s;
+		t.m_rows[0][2] = a.x * a.z * (1 - c) + a.y * s;
+		t.m_rows[1][0] = a.y * a.x * (1 - c) + a.z * s;
+		t.m_rows[1][1] = a.y * a.y * (1 - c) + c;
+		t.m_rows[1][2] = a.y * a.z * (1 - c) - a.x * s;
+		t.m_rows[2][0] = a.z * a.x * (1 - c) - a.y * s;
+		t.m_rows[2][1] = a.z * a.y * (1 - c) + a.x * s;
+		t.m_rows[2][2] = a.z * a.z * (1 - c) + c;
+		return t;
+	}
+
+	// Applies `rhs` first, then this.
+	Transform operator*(const Transform& rhs) const {
+		Transform t;
+		for (int i = 0; i < 3; ++i) {
+			const double* row = m_rows[i];
+			for (int j = 0; j < 4; ++j) {
+				t.m_rows[i][j] = row[0] * rhs.m_rows[0][j] + row[1] * rhs.m_rows[1][j] + row[2] * rhs.m_rows[2][j] + (j == 3 ? row[3] : 0.0);
+			}
+		}
+		return t;
+	}
+
+	// False, leaving `inverse` alone, if L is singular.
+	bool Inverse(Transform& inverse) const {
+		const double c00 = m_rows[1][1] * m_rows[2][2] - m_rows[1][2] * m_rows[2][1];
+		const double c01 = m_rows[1][2] * m_rows[2][0] - m_rows[1][0] * m_rows[2][2];
+		const double c02 = m_rows[1][0] * m_rows[2][1] - m_rows[1][1] * m_rows[2][0];
+		const double det = m_rows[0][0] * c00 + m_rows[0][1] * c01 + m_rows[0][2] * c02;
+		if (!(fabs(det) > 0.0)) {
+			return false;
+		}
+		const double k = 1.0 / det;
+		Transform t;
+		t.m_rows[0][0] = c00 * k;
+		t.m_rows[0][1] = (m_rows[0][2] * m_rows[2][1] - m_rows[0][1] * m_rows[2][2]) * k;
+		t.m_rows[0][2] = (m_rows[0][1] * m_rows[1][2] - m_rows[0][2] * m_rows[1][1]) * k;
+		t.m_rows[1][0] = c01 * k;
+		t.m_rows[1][1] = (m_rows[0][0] * m_rows[2][2] - m_rows[0][2] * m_rows[2][0]) * k;
+		t.m_rows[1][2] = (m_rows[0][2] * m_rows[1][0] - m_rows[0][0] * m_rows[1][2]) * k;
+		t.m_rows[2][0] = c02 * k;
+		t.m_rows[2][1] = (m_rows[0][1] * m_rows[2][0] - m_rows[0][0] * m_rows[2][1]) * k;
+		t.m_rows[2][2] = (m_rows[0][0] * m_rows[1][1] - m_rows[0][1] * m_rows[1][0]) * k;
+		// -L^-1 t
+		for (int i = 0; i < 3; ++i) {
+			t.m_rows[i][3] = -(t.m_rows[i][0] * m_rows[0][3] + t.m_rows[i][1] * m_rows[1][3] + t.m_rows[i][2] * m_rows[2][3]);
+		}
+		inverse = t;
+		return true;
+	}
+
+	Point ApplyPoint(const Point& p) const {
+		return ApplyVector(p) + Vec3(m_rows[0][3], m_rows[1][3], m_rows[2][3]);
+	}
+
+	Vec3 ApplyVector(const Vec3& v) const {
+		return Vec3(m_rows[0][0] * v.x + m_rows[0][1] * v.y + m_rows[0][2] * v.z,
+			m_rows[1][0] * v.x + m_rows[1][1] * v.y + m_rows[1][2] * v.z,
+			m_rows[2][0] * v.x + m_rows[2][1] * v.y + m_rows[2][2] * v.z);
+	}
+
+	// L^T v. On the inverse of a transform this maps normals, which transform by the inverse transpose.
+	Vec3 ApplyTransposed(const Vec3& v) const {
+		return Vec3(m_rows[0][0] * v.x + m_rows[1][0] * v.y + m_rows[2][0] * v.z,
+			m_rows[0][1] * v.x + m_rows[1][1] * v.y + m_rows[2][1] * v.z,
+			m_rows[0][2] * v.x + m_rows[1][2] * v.y + m_rows[2][2] * v.z);
+	}
+
+	// Bounds of the transformed corners of `box`.
+	AABB ApplyBox(const AABB& box) const {
+		AABB result;
+		for (int corner = 0; corner < 8; ++corner) {
+			result.Grow(ApplyPoint(Point(corner & 1 ? box.max.x : box.min.x, corner & 2 ? box.max.y : box.min.y,
+				corner & 4 ? box.max.z : box.min.z)));
+		}
+		return result;
+	}
+
+private:
+	double m_rows[3][4];
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "SphereKernels.hpp"
+
+#include <cstdint>
+
+// AVX2 part of the watertight triangle test behind TriangleMesh, in TriangleKernelsAVX2.cpp
+// built with /arch:AVX2. TriangleMesh gathers four triangles into a Batch on the baseline
+// instruction set and only the vector arithmetic runs here, for the reason given in
+// SphereKernels.hpp.
+class TriangleKernels {
+public:
+	// [vertex][axis][lane]: the vertices relative to the ray origin in the ray's (kx, ky, kz)
+	// axis order, and per edge C-B, A-C, B-A whether its endpoints are swapped so that the
+	// lower-indexed vertex comes first. Unused lanes stay zero, which gives a zero determinant
+	// and so never a hit.
+	struct Batch {
+		alignas(32) double p[3][3][4];
+		alignas(32) int64_t swapped[3][4];
+	};
+
+	// The ray's shear, see TriangleMesh::RaySetup.
+	struct Shear {
+		double sx, sy, sz;
+	};
+
+	// Stores the four distances in `t` and returns the mask of lanes hit within [tmin, closest].
+	static int IntersectAVX2(const Batch& batch, const Shear& shear, double tmin, double closest, double t[4]);
+};
@@ -0,0 +1,46 @@
+// Built with /arch:AVX2. TriangleMesh only calls in here when the CPU has AVX2.
+#include "TriangleKernels.hpp"
+
+#if defined(RT_SPHERE_KERNELS)
+#include <immintrin.h>
+
+int TriangleKernels::IntersectAVX2(const Batch& batch, const Shear& shear, double tmin, double closest, double t[4]) {
+	const __m256d sx = _mm256_set1_pd(shear.sx);
+	const __m256d sy = _mm256_set1_pd(shear.sy);
+	const __m256d sz = _mm256_set1_pd(shear.sz);
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d sign = _mm256_set1_pd(-0.0);
+
+	__m256d x[3], y[3], z[3];
+	for (int k = 0; k < 3; ++k) {
+		z[k] = _mm256_load_pd(batch.p[k][2]);
+		x[k] = _mm256_sub_pd(_mm256_load_pd(batch.p[k][0]), _mm256_mul_pd(sx, z[k]));
+		y[k] = _mm256_sub_pd(_mm256_load_pd(batch.p[k][1]), _mm256_mul_pd(sy, z[k]));
+	}
+	// Edge(P, Q) for the edges C-B, A-C and B-A, as in the scalar path.
+	auto edge = [&](int e, int from, int to) {
+		const __m256d flip = _mm256_castsi256_pd(_mm256_load_si256(reinterpret_cast<const __m256i*>(batch.swapped[e])));
+		const __m256d px = _mm256_blendv_pd(x[from], x[to], flip);
+		const __m256d py = _mm256_blendv_pd(y[from], y[to], flip);
+		const __m256d qx = _mm256_blendv_pd(x[to], x[from], flip);
+		const __m256d qy = _mm256_blendv_pd(y[to], y[from], flip);
+		const __m256d value = _mm256_sub_pd(_mm256_mul_pd(px, qy), _mm256_mul_pd(py, qx));
+		return _mm256_xor_pd(value, _mm256_and_pd(flip, sign));
+	};
+	const __m256d u = edge(0, 2, 1);
+	const __m256d v = edge(1, 0, 2);
+	const __m256d w = edge(2, 1, 0);
+
+	const __m256d anyNeg = _mm256_or_pd(_mm256_or_pd(_mm256_cmp_pd(u, zero, _CMP_LT_OQ), _mm256_cmp_pd(v, zero, _CMP_LT_OQ)), _mm256_cmp_pd(w, zero, _CMP_LT_OQ));
+	const __m256d anyPos = _mm256_or_pd(_mm256_or_pd(_mm256_cmp_pd(u, zero, _CMP_GT_OQ), _mm256_cmp_pd(v, zero, _CMP_GT_OQ)), _mm256_cmp_pd(w, zero, _CMP_GT_OQ));
+	const __m256d det = _mm256_add_pd(_mm256_add_pd(u, v), w);
+	const __m256d inside = _mm256_andnot_pd(_mm256_and_pd(anyNeg, anyPos), _mm256_cmp_pd(det, zero, _CMP_NEQ_OQ));
+
+	const __m256d dist = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(u, z[0]), _mm256_mul_pd(v, z[1])), _mm256_mul_pd(w, z[2]));
+	const __m256d distance = _mm256_div_pd(_mm256_mul_pd(sz, dist), det);
+	const __m256d inRange = _mm256_and_pd(_mm256_cmp_pd(distance, _mm256_set1_pd(tmin), _CMP_GE_OQ),
+		_mm256_cmp_pd(distance, _mm256_set1_pd(closest), _CMP_LE_OQ));
+	_mm256_storeu_pd(t, distance);
+	return _mm256_movemask_pd(_mm256_and_pd(inside, inRange));
+}
+#endif
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "hittable.hpp"
+#include "BVH.hpp"
+#include "FlatArray.hpp"
+#include "TriangleKernels.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Indexed triangle mesh: one shared buffer of float vertices and three 32-bit indices per
+// triangle, with its own BVH over the triangles. A triangle costs its 12 bytes of indices, its
+// share of the vertices and of the BVH nodes; every triangle uses the mesh's one material.
+class TriangleMesh final : public Hittable {
+public:
+	typedef Vec3T<float> Vertex;
+
+	struct Triangle {
+		uint32_t v[3];
+	};
+
+	// Indices must be below vertices.size(). Build() must be called before the mesh is hit.
+	TriangleMesh(FlatArray<Vertex> vertices, FlatArray<Triangle> triangles, MaterialId mat) :
+		m_vertices(std::move(vertices)), m_triangles(std::move(triangles)), m_bvh(), m_mat(mat) { }
+
+	// Builds the BVH, on the threads of `pool` if given, and stores the triangles in its leaf order.
+	void Build(BVH::BuildQuality quality, ThreadPool* pool = nullptr) {
+		const FlatArray<Vertex>& vertices = m_vertices;
+		const FlatArray<Triangle>& triangles = m_triangles;
+		vector<AABB> bounds(triangles.size());
+		ParallelSlices(pool, bounds.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				for (int k = 0; k < 3; ++k) {
+					bounds[i].Grow(Point(vertices[triangles[i].v[k]]));
+				}
+			}
+		});
+		m_bvh.Build(bounds, quality, pool);
+
+		const FlatArray<uint32_t>& order = m_bvh.Indices();
+		FlatArray<Triangle> sorted;
+		sorted.resize(order.size());
+		Triangle* out = sorted.begin();
+		ParallelSlices(pool, order.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				out[i] = triangles[order[i]];
+			}
+		});
+		m_triangles.swap(sorted);
+		m_bvh.ReleaseIndices();
+	}
+
+	size_t TriangleCount() const {
+		return m_triangles.size();
+	}
+
+	size_t VertexCount() const {
+		return m_vertices.size();
+	}
+
+	// Bytes held for geometry and BVH, without the object itself.
+	size_t MemoryBytes() const {
+		return m_vertices.size() * sizeof(Vertex) + m_triangles.size() * sizeof(Triangle) + m_bvh.NodeCount() * sizeof(BVH::Node);
+	}
+
+	bool Intersect(const Ray& r, double tmin, double& closest, PrimId& prim) const override {
+		const RaySetup setup(r);
+		uint32_t triangle = 0;
+		const bool hit = m_bvh.Traverse(r, tmin, closest, [&](uint32_t first, uint32_t count, double& t) {
+			return IntersectLeaf<false>(setup, first, count, tmin, t, triangle);
+		});
+		if (hit) {
+			prim = triangle;
+		}
+		return hit;
+	}
+
+	bool isOccluded(const Ray& r, double tmin, double tmax) const override {
+		const RaySetup setup(r);
+		return m_bvh.TraverseAny(r, tmin, tmax, [&](uint32_t first, uint32_t count) {
+			double t = tmax;
+			uint32_t prim;
+			return IntersectLeaf<true>(setup, first, count, tmin, t, prim);
+		});
+	}
+
+	// Flat shading with the geometric normal; counter-clockwise triangles face their front side.
+	void FillHitRecord(const Ray& r, double t, PrimId prim, HitRecord& rec) const override {
+		const Triangle& tri = m_triangles[(size_t)prim];
+		const Point a(m_vertices[tri.v[0]]);
+		const Point b(m_vertices[tri.v[1]]);
+		const Point c(m_vertices[tri.v[2]]);
+		rec.Set(r, t, cross(b - a, c - a).unit(), m_mat);
+	}
+
+	AABB Bounds() const override {
+		if (!m_bvh.Empty()) {
+			return m_bvh.Bounds();
+		}
+		AABB box;
+		for (const Vertex& v : m_vertices) {
+			box.Grow(Point(v));
+		}
+		return box;
+	}
+
+private:
+	// Per-ray part of the watertight test (Woop, Benthin and Wald, 2013): the axis along which
+	// the direction is largest becomes z, and a shear maps the direction onto +z, so every
+	// triangle can be tested with 2D edge functions in the plane through the origin.
+	struct RaySetup {
+		int kx, ky, kz;
+		double sx, sy, sz;
+		Point origin;
+
+		explicit RaySetup(const Ray& r) : origin(r.origin()) {
+			const Vec3& d = r.direction();
+			const double ax = fabs(d.x), ay = fabs(d.y), az = fabs(d.z);
+			kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+			kx = kz == 2 ? 0 : kz + 1;
+			ky = kx == 2 ? 0 : kx + 1;
+			// Keep the winding, and so the sign of the edge functions, independent of the direction.
+			if (d[kz] < 0.0) {
+				std::swap(kx, ky);
+			}
+			sx = d[kx] / d[kz];
+			sy = d[ky] / d[kz];
+			sz = 1.0 / d[kz];
+		}
+	};
+
+	// Px * Qy - Py * Qx, always evaluated with the lower-indexed vertex as P. Two triangles sharing
+	// an edge then compute exactly the same value for it, up to the sign, even when the compiler
+	// fuses the multiply and subtract, so a ray never slips through between them.
+	static double Edge(double px, double py, uint32_t ip, double qx, double qy, uint32_t iq) {
+		return ip < iq ? px * qy - py * qx : -(qx * py - qy * px);
+	}
+
+	// Vertex `index` relative to the ray origin, in the ray's (kx, ky, kz) axis order.
+	void Load(const RaySetup& s, uint32_t index, double p[3]) const {
+		const Vec3 v = Point(m_vertices[index]) - s.origin;
+		p[0] = v[s.kx];
+		p[1] = v[s.ky];
+		p[2] = v[s.kz];
+	}
+
+	template <bool AnyHit>
+	bool IntersectLeaf(const RaySetup& s, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim) const {
+#if defined(RT_SPHERE_KERNELS)
+		if (s_isa == SphereKernels::Isa::AVX2) {
+			return IntersectAVX2<AnyHit>(s, first, count, tmin, closest, prim);
+		}
+#endif
+		return IntersectScalar<AnyHit>(s, first, count, tmin, closest, prim);
+	}
+
+	template <bool AnyHit>
+	bool IntersectScalar(const RaySetup& s, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim) const {
+		bool hit = false;
+		for (uint32_t i = first; i < first + count; ++i) {
+			const Triangle& tri = m_triangles[i];
+			double a[3], b[3], c[3];
+			Load(s, tri.v[0], a);
+			Load(s, tri.v[1], b);
+			Load(s, tri.v[2], c);
+
+			const double ax = a[0] - s.sx * a[2], ay = a[1] - s.sy * a[2];
+			const double bx = b[0] - s.sx * b[2], by = b[1] - s.sy * b[2];
+			const double cx = c[0] - s.sx * c[2], cy = c[1] - s.sy * c[2];
+
+			const double u = Edge(cx, cy, tri.v[2], bx, by, tri.v[1]);
+			const double v = Edge(ax, ay, tri.v[0], cx, cy, tri.v[2]);
+			const double w = Edge(bx, by, tri.v[1], ax, ay, tri.v[0]);
+			if ((u < 0.0 || v < 0.0 || w < 0.0) && (u > 0.0 || v > 0.0 || w > 0.0)) {
+				continue;
+			}
+			const double det = u + v + w;
+			if (det == 0.0) {
+				continue;
+			}
+			const double t = s.sz * (u * a[2] + v * b[2] + w * c[2]) / det;
+			if (t < tmin || closest < t) {
+				continue;
+			}
+			if (AnyHit) {
+				return true;
+			}
+			closest = t;
+			prim = i;
+			hit = true;
+		}
+		return hit;
+	}
+
+#if defined(RT_SPHERE_KERNELS)
+	// Four triangles per step: gathered into lanes here, tested by TriangleKernels. Shorter
+	// leaves take the same path so every triangle is tested with the same arithmetic.
+	template <bool AnyHit>
+	bool IntersectAVX2(const RaySetup& s, uint32_t first, uint32_t count, double tmin, double& closest, uint32_t& prim) const {
+		const TriangleKernels::Shear shear = { s.sx, s.sy, s.sz };
+		bool hit = false;
+		const uint32_t end = first + count;
+		for (uint32_t i = first; i < end; i += 4) {
+			const int lanes = end - i < 4 ? (int)(end - i) : 4;
+			TriangleKernels::Batch batch = {};
+			for (int lane = 0; lane < lanes; ++lane) {
+				const Triangle& tri = m_triangles[i + lane];
+				for (int k = 0; k < 3; ++k) {
+					double q[3];
+					Load(s, tri.v[k], q);
+					batch.p[k][0][lane] = q[0];
+					batch.p[k][1][lane] = q[1];
+					batch.p[k][2][lane] = q[2];
+				}
+				batch.swapped[0][lane] = tri.v[2] < tri.v[1] ? 0 : -1;
+				batch.swapped[1][lane] = tri.v[0] < tri.v[2] ? 0 : -1;
+				batch.swapped[2][lane] = tri.v[1] < tri.v[0] ? 0 : -1;
+			}
+
+			double ts[4];
+			const int mask = TriangleKernels::IntersectAVX2(batch, shear, tmin, closest, ts);
+			if (AnyHit && mask) {
+				return true;
+			}
+			// In lane order, as the scalar loop accepts them.
+			for (int lane = 0; lane < lanes; ++lane) {
+				if ((mask & (1 << lane)) && !(closest < ts[lane])) {
+					closest = ts[lane];
+					prim = i + lane;
+					hit = true;
+				}
+			}
+		}
+		return hit;
+	}
+#endif
+
+private:
+	// Kernel picked for this CPU when the program starts.
+	static inline const SphereKernels::Isa s_isa = SphereKernels::Detect();
+
+	FlatArray<Vertex> m_vertices;
+	FlatArray<Triangle> m_triangles;
+	BVH m_bvh;
+	MaterialId m_mat;
+};
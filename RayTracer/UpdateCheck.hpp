@@ -0,0 +1,138 @@
+#pragma once
+
+#include "Random.hpp"
+#include "World.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Randomised self-test of the sphere edit path. A built world goes through frames of mixed
+// moves, inserts and removals, each followed by Update(), and after every frame is compared
+// with a world built from scratch from the same spheres: closest-hit distances and shadow
+// tests for random rays, and the lights, must match exactly whether Update() refitted or rebuilt.
+class UpdateCheck {
+public:
+	struct Result {
+		int frames = 0;
+		int rebuilds = 0;
+		size_t rays = 0;
+		// Rays whose closest hit or shadow test differed from the fresh world's.
+		size_t mismatches = 0;
+		// Frames after which the sphere or light count differed, or a light was not one.
+		int countMismatches = 0;
+	};
+
+	static Result Run(uint64_t seed, ThreadPool* pool = nullptr) {
+		Rng rng(seed);
+		World world;
+		const MaterialId diffuse = world.AddMaterial(Lambertian(Color(0.5, 0.5, 0.5)));
+		const MaterialId light = world.AddMaterial(DiffuseLight(Color(4.0, 4.0, 4.0)));
+
+		std::vector<LiveSphere> live;
+		auto randomSphere = [&]() {
+			LiveSphere s;
+			s.center = Point(rng.NextDouble() * EXTENT, rng.NextDouble() * EXTENT, rng.NextDouble() * EXTENT);
+			s.radius = 0.2 + rng.NextDouble();
+			s.mat = rng.NextDouble() < LIGHT_FRACTION ? light : diffuse;
+			return s;
+		};
+		auto add = [&]() {
+			LiveSphere s = randomSphere();
+			s.id = world.AddSphere(s.center, s.radius, s.mat);
+			live.push_back(s);
+		};
+		auto remove = [&](size_t k) {
+			world.RemoveSphere(live[k].id);
+			live[k] = live.back();
+			live.pop_back();
+		};
+
+		for (size_t i = 0; i < SPHERE_COUNT; ++i) {
+			add();
+		}
+		// Edits before the first build take the plain array path.
+		for (size_t i = 0; i < SPHERE_COUNT / 100; ++i) {
+			remove(Pick(rng, live.size()));
+		}
+		world.Build(pool);
+
+		Result result;
+		for (int frame = 0; frame < FRAME_COUNT; ++frame) {
+			// Small moves keep refits cheap; the large ones later degrade the tree until Update()
+			// rebuilds it, so both paths are compared.
+			const double moveScale = frame < FRAME_COUNT / 2 ? SMALL_MOVE : LARGE_MOVE;
+			for (int edit = 0; edit < EDITS_PER_FRAME; ++edit) {
+				const double p = live.empty() ? 0.6 : rng.NextDouble();
+				if (p < 0.5) {
+					LiveSphere& s = live[Pick(rng, live.size())];
+					s.center = s.center + (Vec3(rng.NextDouble(), rng.NextDouble(), rng.NextDouble()) - Vec3(0.5, 0.5, 0.5)) * moveScale;
+					world.MoveSphere(s.id, s.center, s.radius);
+				}
+				else if (p < 0.75) {
+					add();
+				}
+				else {
+					remove(Pick(rng, live.size()));
+				}
+			}
+			result.rebuilds += world.Update(pool);
+
+			World fresh;
+			fresh.AddMaterial(Lambertian(Color(0.5, 0.5, 0.5)));
+			fresh.AddMaterial(DiffuseLight(Color(4.0, 4.0, 4.0)));
+			fresh.Reserve(live.size(), 2);
+			size_t lights = 0;
+			for (const LiveSphere& s : live) {
+				fresh.AddSphere(s.center, s.radius, s.mat);
+				lights += s.mat == light;
+			}
+			fresh.Build(pool);
+
+			bool countsMatch = world.SphereCount() == live.size() && world.LightCount() == lights;
+			for (uint32_t slot : world.Lights()) {
+				countsMatch &= world.GetMaterial(world.SphereMaterials()[slot]).AsLight() != nullptr;
+			}
+			result.countMismatches += !countsMatch;
+
+			for (size_t i = 0; i < RAYS_PER_FRAME; ++i) {
+				const Ray r(Point(rng.NextDouble() * EXTENT, rng.NextDouble() * EXTENT, -10.0),
+					Vec3(rng.NextDouble() - 0.5, rng.NextDouble() - 0.5, 1.0));
+				double t = INFINITY, freshT = INFINITY;
+				PrimId prim, freshPrim;
+				const bool hit = world.Intersect(r, 0.001, t, prim);
+				const bool freshHit = fresh.Intersect(r, 0.001, freshT, freshPrim);
+				// Spheres at the same distance may be reported in either order, so compare distances.
+				if (hit != freshHit || (hit && t != freshT)
+					|| world.isOccluded(r, 0.001, SHADOW_DISTANCE) != fresh.isOccluded(r, 0.001, SHADOW_DISTANCE)) {
+					++result.mismatches;
+				}
+			}
+			result.rays += RAYS_PER_FRAME;
+			++result.frames;
+		}
+		return result;
+	}
+
+private:
+	static constexpr size_t SPHERE_COUNT = 20000;
+	static constexpr int FRAME_COUNT = 30;
+	static constexpr int EDITS_PER_FRAME = 200;
+	static constexpr size_t RAYS_PER_FRAME = 20000;
+	static constexpr double EXTENT = 100.0;
+	static constexpr double SMALL_MOVE = 4.0;
+	static constexpr double LARGE_MOVE = 60.0;
+	static constexpr double LIGHT_FRACTION = 0.05;
+	static constexpr double SHADOW_DISTANCE = 50.0;
+
+	struct LiveSphere {
+		SphereId id = 0;
+		Point center;
+		double radius = 0.0;
+		MaterialId mat = 0;
+	};
+
+	static size_t Pick(Rng& rng, size_t count) {
+		return (size_t)(rng.Next() % count);
+	}
+};
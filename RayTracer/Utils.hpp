@@ -1,15 +1,24 @@
 #pragma once
 
 #include "Vec3.hpp"
+#include "Random.hpp"
+#include "Sampling.hpp"
 
 #include <cmath>
-#include <random>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 
 typedef uint8_t byte;
 
 #define BYTE_MAX (uint16_t)0xFF
-#define clamp(x) (x < 0.0) ? 0.0 : ((x > 1.0) ? 1.0 : x)
+// A function rather than a macro so it does not clobber std::clamp from <algorithm>.
+inline double clamp(double x) {
+	return (x < 0.0) ? 0.0 : ((x > 1.0) ? 1.0 : x);
+}
 
+// Plain triple of doubles: trivially copyable and no bigger than its components, so
+// framebuffers and accumulators of Color can be memcpy'd and vectorized.
 struct Color : public Vec3 {
 	double length() const = delete;
 	double lengthsq() const = delete;
@@ -19,87 +28,70 @@ struct Color : public Vec3 {
 
 	Color(const Vec3& rhs) : Vec3(rhs) {}
 
-	Color & operator=(const Vec3& rhs) {
-		*this = Color(rhs);
-		return *this;
-	}
-
-	Color& operator=(const Color& rhs) {
-		this->x = rhs.r;
-		this->y = rhs.g;
-		this->z = rhs.b;
-		return *this;
-	}
+	double r() const { return x; }
+	double g() const { return y; }
+	double b() const { return z; }
 
 	Color& operator+=(const Color& rhs) {
-		*this = *this + rhs;
+		x += rhs.x;
+		y += rhs.y;
+		z += rhs.z;
 		return *this;
 	}
 
 	Color& operator/=(double val) {
-		*this = *this / val;
+		x /= val;
+		y /= val;
+		z /= val;
 		return *this;
 	}
 
 	Color& operator*=(double val) {
-		*this = *this * val;
+		x *= val;
+		y *= val;
+		z *= val;
 		return *this;
 	}
-
-	double& r = Vec3::x;
-	double& g = Vec3::y;
-	double& b = Vec3::z;
 };
 
-inline Color operator+(const Color& lhs, const Color& rhs) {
-	return Color(operator+((Vec3)lhs, (Vec3)rhs));
-}
+static_assert(std::is_trivially_copyable<Color>::value, "Color must stay memcpy-able");
+static_assert(sizeof(Color) == 3 * sizeof(double), "Color must not carry anything besides its components");
 
-inline double random_double(double min = 0.0, double max = 1.0) {
-	static std::default_random_engine rand;
-	std::uniform_real_distribution<double> dist(min, max);
-	return dist(rand);
+inline Color operator+(const Color& lhs, const Color& rhs) {
+	return Color(lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z);
 }
 
-inline Vec3 random_vec3() {
-	return Vec3(random_double(), random_double(), random_double());
+// One counter-based stream per thread. Its output depends only on (seed, stream) and how many
+// numbers were drawn since seed_random(), never on which thread draws them. Rendering draws from
+// a Sampler instead; this is for scene setup, tools and tests.
+inline Philox& random_engine() {
+	thread_local Philox rng;
+	return rng;
 }
 
-inline Vec3 random_unit_vec() {
-	return random_vec3().unit();
+inline void seed_random(uint64_t seed, uint64_t stream = 0) {
+	random_engine() = Philox(seed, stream);
 }
 
-inline Point rand_point_in_unit_s() {
-	while (true) {
-		Point p = random_vec3();
-		if (p.lengthsq() < 1)
-			return p;
-	}
+inline double random_double() {
+	return random_engine().NextDouble();
 }
 
-inline Point rand_point_in_unit_disk() {
-	while (true) {
-		Point p(random_double(-1, 1), random_double(-1, 1), 0);
-		if (p.lengthsq() < 1) return p;
-	}
+inline double random_double(double min, double max) {
+	return min + (max - min) * random_engine().NextDouble();
 }
 
-inline Point rand_point_in_hemisphere(const Vec3& normal) {
-	Point in_unit_s = rand_point_in_unit_s();
-	if (dot(in_unit_s, normal) > 0.0) {
-		return in_unit_s;
-	}
-	return -in_unit_s;
+inline Vec3 random_vec3() {
+	return Vec3(random_double(), random_double(), random_double());
 }
 
-inline Vec3 reflect(Vec3 ray_dir, Vec3 normal) {
-	ray_dir = ray_dir.unit();
-	normal = normal.unit();
+// Both directions must be unit length, as ray directions and hit normals are.
+inline Vec3 reflect(const Vec3& ray_dir, const Vec3& normal) {
 	return ray_dir - 2 * dot(ray_dir, normal) * normal;
 }
 
 inline Vec3 refract(const Vec3& uv, const Vec3 & n, double etai_by_etan) {
-	auto cthetha = fmin(dot(-uv.unit(), n.unit()), 1.0);
+	auto cthetha = fmin(dot(-uv, n), 1.0);
 
 	Vec3 r_out_per = etai_by_etan * (uv + cthetha * n);
 	Vec3 r_out_par = -sqrt(fabs(1.0 - r_out_per.lengthsq())) * n;
@@ -111,4 +103,21 @@ inline Vec3 refract(const Vec3& uv, const Vec3 & n, double etai_by_etan) {
 double degrees_to_radians(double angle) {
 	const static double v = (double)PI / 180;
 	return v * angle;
-}
\ No newline at end of file
+}
+
+// Fast non-cryptographic hash of a byte stream, eight bytes per step. Feeding a stream in
+// pieces gives the same value as hashing it whole as long as every piece but the last is a
+// multiple of eight bytes long.
+inline uint64_t hash_bytes(uint64_t h, const void* data, size_t size) {
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (; size >= 8; bytes += 8, size -= 8) {
+		uint64_t word;
+		memcpy(&word, bytes, 8);
+		h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 32;
+	}
+	for (; size > 0; ++bytes, --size) {
+		h = (h ^ *bytes) * 0x100000001b3ull;
+	}
+	return h;
+}
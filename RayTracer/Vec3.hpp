@@ -2,79 +2,99 @@
 
 #include <cmath>
 
-struct Vec3;
+// Templated on the scalar so the math core can be instantiated for float as well as double.
+// The scalar parameters of the free operators are non-deduced, so `vec * 2` still works.
+template <typename T>
+struct Vec3T {
+	typedef T Scalar;
 
-// Used by Vec3::unit()
-Vec3 operator/(const Vec3& vec, const double val);
+	T x;
+	T y;
+	T z;
 
-struct Vec3 {
-	double x;
-	double y;
-	double z;
+	Vec3T() : x(0), y(0), z(0) { }
 
-	Vec3() : x(0.0), y(0.0), z(0.0) { }
-
-	Vec3(double xval, double yval, double zval) :
+	Vec3T(T xval, T yval, T zval) :
 		x(xval), y(yval), z(zval) { }
 
-	const double length() const {
+	// Precision conversions are explicit so float never leaks silently into double code.
+	template <typename U>
+	explicit Vec3T(const Vec3T<U>& rhs) :
+		x(static_cast<T>(rhs.x)), y(static_cast<T>(rhs.y)), z(static_cast<T>(rhs.z)) { }
+
+	const T length() const {
 		return std::sqrt(this->lengthsq());
 	}
 
-	const double lengthsq() const {
+	const T lengthsq() const {
 		return x * x + y * y + z * z;
 	}
 
-	const Vec3 unit() const {
+	const Vec3T unit() const {
 		return *this / this->length();
 	}
 
-	Vec3 operator-() const {
-		return Vec3(-x, -y, -z);
+	T operator[](int axis) const {
+		return axis == 0 ? x : (axis == 1 ? y : z);
+	}
+
+	Vec3T operator-() const {
+		return Vec3T(-x, -y, -z);
 	}
 
 	bool nearZero() const {
-		double s = 1e-8;
-		return (fabs(x) < s) && (fabs(y) < s) && (fabs(z) < s);
+		T s = static_cast<T>(1e-8);
+		return (std::fabs(x) < s) && (std::fabs(y) < s) && (std::fabs(z) < s);
 	}
 };
 
-Vec3 operator+(const Vec3& lhs, const Vec3& rhs) {
-	return Vec3(lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z);
+template <typename T>
+Vec3T<T> operator+(const Vec3T<T>& lhs, const Vec3T<T>& rhs) {
+	return Vec3T<T>(lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z);
 }
 
-Vec3 operator-(const Vec3& lhs, const Vec3& rhs) {
+template <typename T>
+Vec3T<T> operator-(const Vec3T<T>& lhs, const Vec3T<T>& rhs) {
 	return lhs + (-rhs);
 }
 
-Vec3 operator*(const Vec3& vec, const double val) {
-	return Vec3(vec.x * val, vec.y * val, vec.z * val);
+template <typename T>
+Vec3T<T> operator*(const Vec3T<T>& vec, const typename Vec3T<T>::Scalar val) {
+	return Vec3T<T>(vec.x * val, vec.y * val, vec.z * val);
 }
 
-Vec3 operator*(const double val, const Vec3& vec) {
+template <typename T>
+Vec3T<T> operator*(const typename Vec3T<T>::Scalar val, const Vec3T<T>& vec) {
 	return vec * val;
 }
 
-Vec3 operator*(const Vec3& lhs, const Vec3& rhs) {
-	return Vec3(lhs.x * rhs.x, lhs.y * rhs.y, lhs.z * rhs.z);
+template <typename T>
+Vec3T<T> operator*(const Vec3T<T>& lhs, const Vec3T<T>& rhs) {
+	return Vec3T<T>(lhs.x * rhs.x, lhs.y * rhs.y, lhs.z * rhs.z);
 }
 
-Vec3 operator/(const Vec3& vec, const double val) {
-	return Vec3(vec.x / val, vec.y / val, vec.z / val);
+template <typename T>
+Vec3T<T> operator/(const Vec3T<T>& vec, const typename Vec3T<T>::Scalar val) {
+	return Vec3T<T>(vec.x / val, vec.y / val, vec.z / val);
 }
 
-double dot(const Vec3& a, const Vec3& b) {
+template <typename T>
+T dot(const Vec3T<T>& a, const Vec3T<T>& b) {
 	return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
-inline Vec3 cross(const Vec3 & u, const Vec3 & v) {
-	return Vec3(
+template <typename T>
+inline Vec3T<T> cross(const Vec3T<T> & u, const Vec3T<T> & v) {
+	return Vec3T<T>(
 		u.y * v.z - u.z * v.y,
 		u.z * v.x - u.x * v.z,
 		u.x * v.y - u.y * v.x
 	);
 }
 
+typedef Vec3T<double> Vec3;
+typedef Vec3T<float> Vec3f;
+
 typedef Vec3 Point;
 typedef Vec3 Direction;
-typedef Vec3 Normal;
\ No newline at end of file
+typedef Vec3 Normal;
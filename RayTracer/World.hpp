@@ -0,0 +1,607 @@
+#pragma once
+
+#include "hittable.hpp"
+#include "BVH.hpp"
+#include "SphereSet.hpp"
+#include "TriangleMesh.hpp"
+#include "InstanceSet.hpp"
+#include "MaterialTable.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// A direction towards an emitter, picked by World::SampleLight().
+struct LightSample {
+	Vec3 direction;
+	double distance = 0.0;
+	// Solid-angle density, including the probability of picking this light.
+	double pdf = 0.0;
+	Color emitted;
+};
+
+// Handle of a sphere in a World. Spheres are stored in BVH leaf order, so their positions
+// change with every build; ids stay the same until the sphere is removed.
+typedef uint32_t SphereId;
+
+// Spheres live in a SphereSet so both the linear and the BVH path can test them in batches.
+// Triangle meshes bring their own BVH and are tested after the spheres, then instances of
+// shared meshes through their top-level BVH.
+class World : public Hittable {
+public:
+	// Linear tests every object and is kept as a reference to benchmark the BVH against.
+	enum class AccelMode {
+		Linear,
+		BVH
+	};
+
+	World() : m_materialTable(), m_spheres(), m_materials(), m_lights(), m_bvh(), m_mode(AccelMode::BVH),
+		m_quality(BVH::BuildQuality::High), m_built(false), m_storage(), m_meshes(), m_meshBase(), m_instances(),
+		m_ids(), m_slots(), m_deadCount(0), m_builtCost(0.0), m_rebuildThreshold(DEFAULT_REBUILD_THRESHOLD) {}
+
+	MaterialId AddMaterial(const AnyMaterial& material) {
+		return m_materialTable.Add(material);
+	}
+
+	size_t MaterialCount() const {
+		return m_materialTable.Size();
+	}
+
+	const AnyMaterial& GetMaterial(MaterialId id) const {
+		return m_materialTable[id];
+	}
+
+	// Spheres can be added, moved and removed at any time. Before the first Build() that just
+	// edits the arrays; afterwards the BVH keeps its topology and only the leaves touched are
+	// marked dirty, for Update() to refit before the next render.
+
+	SphereId AddSphere(Point center, double radius, MaterialId mat) {
+		if (!Refittable()) {
+			const SphereId id = AppendSphere(center, radius, mat);
+			m_bvh.Clear();
+			m_built = false;
+			return id;
+		}
+
+		// Leaves own contiguous ranges, so the chosen leaf moves to the end of the arrays and
+		// the new sphere goes after it. Its old slots stay dead until the next build.
+		EnableUpdates();
+		const double r = fabs(radius);
+		const uint32_t leaf = m_bvh.FindInsertLeaf(AABB(center - Vec3(r, r, r), center + Vec3(r, r, r)));
+		const BVH::Node node = m_bvh.Nodes()[leaf];
+		const uint32_t first = (uint32_t)m_spheres.Size();
+		for (uint32_t slot = node.offset; slot < node.offset + node.count; ++slot) {
+			if (m_ids[slot] != NO_SPHERE) {
+				const uint32_t moved = (uint32_t)m_spheres.Size();
+				AppendSphere(m_spheres.Center(slot), m_spheres.Radius(slot), m_materials[slot], m_ids[slot]);
+				MoveLight(slot, moved);
+				m_ids[slot] = NO_SPHERE;
+				++m_deadCount;
+			}
+		}
+		const SphereId id = AppendSphere(center, radius, mat);
+		if (GetMaterial(mat).AsLight()) {
+			m_lights.push_back(m_slots[id]);
+		}
+		m_bvh.SetLeaf(leaf, first, (uint32_t)m_spheres.Size() - first);
+		return id;
+	}
+
+	void MoveSphere(SphereId id, Point center, double radius) {
+		EnableUpdates();
+		const uint32_t slot = m_slots[id];
+		m_spheres.Set(slot, center, radius);
+		if (Refittable()) {
+			m_bvh.MarkDirty(m_bvh.LeafOf(slot));
+		}
+		else {
+			m_built = false;
+		}
+	}
+
+	void RemoveSphere(SphereId id) {
+		EnableUpdates();
+		const uint32_t slot = m_slots[id];
+		RemoveLight(slot);
+		if (!Refittable()) {
+			KillSlot(slot);
+			m_bvh.Clear();
+			m_built = false;
+			return;
+		}
+
+		// The leaf's last sphere fills the hole. A leaf cannot be empty, so the last sphere of
+		// one stays behind as a dead slot and its bounds refit to nothing.
+		const uint32_t leaf = m_bvh.LeafOf(slot);
+		const BVH::Node node = m_bvh.Nodes()[leaf];
+		if (node.count == 1) {
+			KillSlot(slot);
+			m_bvh.MarkDirty(leaf);
+			return;
+		}
+		const uint32_t last = node.offset + node.count - 1;
+		m_slots[id] = NO_SPHERE;
+		if (slot != last) {
+			m_spheres.Set(slot, m_spheres.Center(last), m_spheres.Radius(last));
+			m_materials[slot] = m_materials[last];
+			m_ids[slot] = m_ids[last];
+			m_slots[m_ids[slot]] = slot;
+			MoveLight(last, slot);
+		}
+		m_ids[last] = NO_SPHERE;
+		++m_deadCount;
+		m_bvh.SetLeaf(leaf, node.offset, node.count - 1);
+	}
+
+	// Spheres present; Spheres() also holds slots freed since the last build.
+	size_t SphereCount() const {
+		return m_spheres.Size() - m_deadCount;
+	}
+
+	// Adds a mesh whose BVH has been built. Its triangles are numbered after those of the
+	// meshes added before it.
+	void AddMesh(std::shared_ptr<const TriangleMesh> mesh) {
+		const size_t base = m_meshes.empty() ? 0 : m_meshBase.back() + m_meshes.back()->TriangleCount();
+		m_meshes.push_back(std::move(mesh));
+		m_meshBase.push_back((uint32_t)base);
+	}
+
+	size_t MeshCount() const {
+		return m_meshes.size();
+	}
+
+	size_t MeshTriangleCount() const {
+		return m_meshes.empty() ? 0 : m_meshBase.back() + m_meshes.back()->TriangleCount();
+	}
+
+	size_t MeshMemoryBytes() const {
+		size_t bytes = 0;
+		for (const auto& mesh : m_meshes) {
+			bytes += mesh->MemoryBytes();
+		}
+		return bytes;
+	}
+
+	// Adds a built mesh to be placed by AddInstance() rather than on its own.
+	ObjectId AddObject(std::shared_ptr<const TriangleMesh> mesh) {
+		return m_instances.AddObject(std::move(mesh));
+	}
+
+	// False if `objectToWorld` cannot be inverted.
+	bool AddInstance(ObjectId object, const Transform& objectToWorld) {
+		m_built = false;
+		return m_instances.Add(object, objectToWorld);
+	}
+
+	const InstanceSet& Instances() const {
+		return m_instances;
+	}
+
+	// Sizes the storage up front when the number of objects is known, as when loading a file.
+	void Reserve(size_t spheres, size_t materials) {
+		m_spheres.Reserve(spheres);
+		m_materials.reserve(spheres);
+		m_materialTable.Reserve(materials);
+	}
+
+	void SetAccelMode(AccelMode mode) {
+		if (mode != m_mode) {
+			m_built = false;
+		}
+		m_mode = mode;
+	}
+
+	AccelMode GetAccelMode() const {
+		return m_mode;
+	}
+
+	// Applies from the next Build(), and to meshes loaded into the world from then on; Fast
+	// suits scenes rebuilt more often than they are traced.
+	void SetBuildQuality(BVH::BuildQuality quality) {
+		m_quality = quality;
+	}
+
+	BVH::BuildQuality GetBuildQuality() const {
+		return m_quality;
+	}
+
+	// Must be called after the last object is added and before rendering. With a pool the
+	// sphere BVH is built on all its threads.
+	void Build(ThreadPool* pool = nullptr) {
+		m_bvh.Clear();
+		if (m_deadCount > 0) {
+			Compact(pool);
+		}
+		if (m_mode == AccelMode::BVH) {
+			BuildBVH(pool);
+		}
+		m_instances.Build(m_quality, pool);
+
+		m_lights.clear();
+		for (uint32_t i = 0; i < m_spheres.Size(); ++i) {
+			if (GetMaterial(m_materials[i]).AsLight()) {
+				m_lights.push_back(i);
+			}
+		}
+		m_built = true;
+	}
+
+	// True after Build() or SetPrebuilt() until objects or the accel mode change. Changes to
+	// spheres in a built BVH leave it built but needing an Update().
+	bool IsBuilt() const {
+		return m_built;
+	}
+
+	bool NeedsUpdate() const {
+		return m_bvh.DirtyCount() > 0;
+	}
+
+	// Refits the nodes dirtied since the last build or update, then rebuilds instead if refitting
+	// has left the BVH's SAH cost above the rebuild threshold times its cost when built. True if
+	// it rebuilt.
+	bool Update(ThreadPool* pool = nullptr) {
+		m_bvh.Refit([&](uint32_t first, uint32_t count) {
+			AABB box;
+			for (uint32_t slot = first; slot < first + count; ++slot) {
+				if (m_ids[slot] != NO_SPHERE) {
+					box.Grow(m_spheres.Bounds(slot));
+				}
+			}
+			return box;
+		});
+		if (m_bvh.Cost() > m_builtCost * m_rebuildThreshold) {
+			Build(pool);
+			return true;
+		}
+		return false;
+	}
+
+	// SAH cost of the refitted BVH relative to its cost when built.
+	double RefitCostRatio() const {
+		return m_bvh.UpdatesEnabled() && m_builtCost > 0.0 ? m_bvh.Cost() / m_builtCost : 1.0;
+	}
+
+	void SetRebuildThreshold(double threshold) {
+		m_rebuildThreshold = threshold;
+	}
+
+	// Takes spheres already in leaf order with their BVH and light list, built by an earlier
+	// Build() and typically viewing a mapped scene cache. `storage` is whatever owns that memory
+	// and is kept alive with the world. The materials must have been added already.
+	void SetPrebuilt(SphereSet spheres, FlatArray<MaterialId> materials, FlatArray<uint32_t> lights, BVH bvh,
+		std::shared_ptr<const void> storage) {
+		m_spheres = std::move(spheres);
+		m_materials = std::move(materials);
+		m_lights = std::move(lights);
+		m_bvh = std::move(bvh);
+		m_storage = std::move(storage);
+		m_mode = AccelMode::BVH;
+		m_built = true;
+		m_ids.clear();
+		m_slots.clear();
+		m_deadCount = 0;
+	}
+
+	size_t BVHNodeCount() const {
+		return m_bvh.NodeCount();
+	}
+
+	size_t LightCount() const {
+		return m_lights.size();
+	}
+
+	// Picks a light with u0 and a direction towards it with (u1, u2), uniformly within the
+	// cone the light sphere subtends. Fails when `from` is inside the chosen light.
+	bool SampleLight(const Point& from, double u0, double u1, double u2, LightSample& ls) const {
+		if (m_lights.empty()) {
+			return false;
+		}
+		const uint32_t prim = m_lights[std::min((size_t)(u0 * m_lights.size()), m_lights.size() - 1)];
+
+		double cosThetaMax;
+		if (!LightCone(from, prim, cosThetaMax)) {
+			return false;
+		}
+		const Vec3 toCenter = m_spheres.Center(prim) - from;
+		ls.direction = to_frame(sample_uniform_cone(u1, u2, cosThetaMax), toCenter.unit());
+
+		// Distance to the near side of the sphere, clamped for directions that graze its silhouette.
+		const double radius = m_spheres.Radius(prim);
+		const double half_b = -dot(ls.direction, toCenter);
+		const double d = fmax(0.0, half_b * half_b - (toCenter.lengthsq() - radius * radius));
+		ls.distance = -half_b - sqrt(d);
+		ls.pdf = uniform_cone_pdf(cosThetaMax) / m_lights.size();
+		ls.emitted = GetMaterial(m_materials[prim]).AsLight()->Emit();
+		return true;
+	}
+
+	// Density with which SampleLight() from `from` would have produced a direction hitting `prim`.
+	double LightPdf(const Point& from, PrimId prim) const {
+		double cosThetaMax;
+		if (prim >= MESH_PRIM || !GetMaterial(m_materials[(size_t)prim]).AsLight() || !LightCone(from, (uint32_t)prim, cosThetaMax)) {
+			return 0.0;
+		}
+		return uniform_cone_pdf(cosThetaMax) / m_lights.size();
+	}
+
+	const SphereSet& Spheres() const {
+		return m_spheres;
+	}
+
+	const FlatArray<MaterialId>& SphereMaterials() const {
+		return m_materials;
+	}
+
+	const FlatArray<uint32_t>& Lights() const {
+		return m_lights;
+	}
+
+	const BVH& GetBVH() const {
+		return m_bvh;
+	}
+
+	bool Intersect(const Ray & r, double tmin, double& closest, PrimId& prim) const override {
+		uint32_t sphere = 0;
+		bool hit;
+		if (m_mode == AccelMode::BVH && !m_bvh.Empty()) {
+			hit = m_bvh.Traverse(r, tmin, closest, [&](uint32_t first, uint32_t count, double& t) {
+				return m_spheres.Intersect(r, first, count, tmin, t, sphere);
+			});
+		}
+		else {
+			hit = m_spheres.Intersect(r, 0, (uint32_t)m_spheres.Size(), tmin, closest, sphere);
+		}
+		if (hit) {
+			prim = sphere;
+		}
+		for (size_t m = 0; m < m_meshes.size(); ++m) {
+			PrimId triangle;
+			if (m_meshes[m]->Intersect(r, tmin, closest, triangle)) {
+				prim = MESH_PRIM | (m_meshBase[m] + triangle);
+				hit = true;
+			}
+		}
+		PrimId instance;
+		if (!m_instances.Empty() && m_instances.Intersect(r, tmin, closest, instance)) {
+			prim = INSTANCE_PRIM | instance;
+			hit = true;
+		}
+		return hit;
+	}
+
+	bool isOccluded(const Ray& r, double tmin, double tmax) const override {
+		bool occluded;
+		if (m_mode == AccelMode::BVH && !m_bvh.Empty()) {
+			occluded = m_bvh.TraverseAny(r, tmin, tmax, [&](uint32_t first, uint32_t count) {
+				return m_spheres.Occluded(r, first, count, tmin, tmax);
+			});
+		}
+		else {
+			occluded = m_spheres.Occluded(r, 0, (uint32_t)m_spheres.Size(), tmin, tmax);
+		}
+		for (size_t m = 0; m < m_meshes.size() && !occluded; ++m) {
+			occluded = m_meshes[m]->isOccluded(r, tmin, tmax);
+		}
+		return occluded || (!m_instances.Empty() && m_instances.Occluded(r, tmin, tmax));
+	}
+
+	void FillHitRecord(const Ray& r, double t, PrimId prim, HitRecord& rec) const override {
+		if (prim & INSTANCE_PRIM) {
+			m_instances.FillHitRecord(r, t, prim & ~INSTANCE_PRIM, rec);
+			return;
+		}
+		if (prim & MESH_PRIM) {
+			const uint32_t triangle = (uint32_t)(prim & ~MESH_PRIM);
+			const size_t m = std::upper_bound(m_meshBase.begin(), m_meshBase.end(), triangle) - m_meshBase.begin() - 1;
+			m_meshes[m]->FillHitRecord(r, t, triangle - m_meshBase[m], rec);
+			return;
+		}
+		const uint32_t sphere = (uint32_t)prim;
+		rec.Set(r, t, (r.at(t) - m_spheres.Center(sphere)) / fabs(m_spheres.Radius(sphere)), m_materials[sphere]);
+	}
+
+	AABB Bounds() const override {
+		AABB box;
+		for (uint32_t i = 0; i < m_spheres.Size(); ++i) {
+			if (m_ids.empty() || m_ids[i] != NO_SPHERE) {
+				box.Grow(m_spheres.Bounds(i));
+			}
+		}
+		for (const auto& mesh : m_meshes) {
+			box.Grow(mesh->Bounds());
+		}
+		if (!m_instances.Empty()) {
+			box.Grow(m_instances.Bounds());
+		}
+		return box;
+	}
+
+	void Clear() {
+		m_materialTable.Clear();
+		m_spheres.Clear();
+		m_materials.clear();
+		m_lights.clear();
+		m_bvh.Clear();
+		m_built = false;
+		m_storage.reset();
+		m_meshes.clear();
+		m_meshBase.clear();
+		m_instances.Clear();
+		m_ids.clear();
+		m_slots.clear();
+		m_deadCount = 0;
+	}
+
+private:
+	// Prims below MESH_PRIM are spheres. With MESH_PRIM set the rest is the triangle's number
+	// across all meshes; with INSTANCE_PRIM it is what InstanceSet::Intersect() reported.
+	static constexpr PrimId MESH_PRIM = 0x80000000u;
+	static constexpr PrimId INSTANCE_PRIM = 1ull << 63;
+
+	// Marks slots no sphere lives in, and ids whose sphere was removed.
+	static constexpr uint32_t NO_SPHERE = 0xffffffffu;
+	// Refit SAH cost, relative to the cost when built, past which Update() rebuilds.
+	static constexpr double DEFAULT_REBUILD_THRESHOLD = 1.5;
+
+	bool Refittable() const {
+		return m_built && m_mode == AccelMode::BVH && !m_bvh.Empty();
+	}
+
+	// Appends a sphere, under a new id unless it keeps `id`.
+	SphereId AppendSphere(const Point& center, double radius, MaterialId mat, SphereId id = NO_SPHERE) {
+		const uint32_t slot = m_spheres.Add(center, radius);
+		m_materials.push_back(mat);
+		if (id == NO_SPHERE) {
+			id = m_slots.empty() ? slot : (SphereId)m_slots.size();
+			if (!m_slots.empty()) {
+				m_slots.push_back(slot);
+			}
+		}
+		else {
+			m_slots[id] = slot;
+		}
+		if (!m_ids.empty()) {
+			m_ids.push_back(id);
+		}
+		return id;
+	}
+
+	// Sets up the id maps, and the BVH's update state when it is built. Until the first change
+	// ids are implicit: a sphere's id is its slot before the first build, and after a build
+	// m_ids alone holds them.
+	void EnableUpdates() {
+		if (m_slots.empty()) {
+			if (m_ids.empty()) {
+				m_ids.resize(m_spheres.Size());
+				for (uint32_t slot = 0; slot < m_ids.size(); ++slot) {
+					m_ids[slot] = slot;
+				}
+			}
+			m_slots.assign(m_ids.size(), NO_SPHERE);
+			for (uint32_t slot = 0; slot < m_ids.size(); ++slot) {
+				m_slots[m_ids[slot]] = slot;
+			}
+		}
+		if (Refittable() && !m_bvh.UpdatesEnabled()) {
+			m_bvh.EnableUpdates();
+			m_builtCost = m_bvh.Cost();
+		}
+	}
+
+	void KillSlot(uint32_t slot) {
+		m_slots[m_ids[slot]] = NO_SPHERE;
+		m_ids[slot] = NO_SPHERE;
+		++m_deadCount;
+	}
+
+	void RemoveLight(uint32_t slot) {
+		for (size_t i = 0; i < m_lights.size(); ++i) {
+			if (m_lights[i] == slot) {
+				m_lights[i] = m_lights[m_lights.size() - 1];
+				m_lights.resize(m_lights.size() - 1);
+				return;
+			}
+		}
+	}
+
+	void MoveLight(uint32_t from, uint32_t to) {
+		if (GetMaterial(m_materials[to]).AsLight()) {
+			for (uint32_t& light : m_lights) {
+				if (light == from) {
+					light = to;
+				}
+			}
+		}
+	}
+
+	// Drops dead slots, keeping the order of the rest.
+	void Compact(ThreadPool* pool) {
+		FlatArray<uint32_t> live;
+		live.reserve(m_spheres.Size() - m_deadCount);
+		for (uint32_t slot = 0; slot < m_spheres.Size(); ++slot) {
+			if (m_ids[slot] != NO_SPHERE) {
+				live.push_back(slot);
+			}
+		}
+		m_spheres.Reorder(live, pool);
+		m_materials = Gather(m_materials, live, pool);
+		m_ids = Gather(m_ids, live, pool);
+		for (uint32_t slot = 0; slot < m_ids.size(); ++slot) {
+			m_slots[m_ids[slot]] = slot;
+		}
+		m_deadCount = 0;
+	}
+
+	// values[order[i]] for every i.
+	template <typename T>
+	static FlatArray<T> Gather(const FlatArray<T>& values, const FlatArray<uint32_t>& order, ThreadPool* pool) {
+		FlatArray<T> out;
+		out.resize(order.size());
+		T* dst = out.begin();
+		ParallelSlices(pool, order.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				dst[i] = values[order[i]];
+			}
+		});
+		return out;
+	}
+
+	void BuildBVH(ThreadPool* pool) {
+		vector<AABB> bounds(m_spheres.Size());
+		ParallelSlices(pool, bounds.size(), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				bounds[i] = m_spheres.Bounds((uint32_t)i);
+			}
+		});
+		m_bvh.Build(bounds, m_quality, pool);
+
+		// Store the spheres in leaf order so every leaf is one contiguous batch, and keep
+		// track of which sphere went where.
+		const auto& order = m_bvh.Indices();
+		m_spheres.Reorder(order, pool);
+		m_materials = Gather(m_materials, order, pool);
+		m_ids = m_ids.empty() ? order : Gather(m_ids, order, pool);
+		if (!m_slots.empty()) {
+			for (uint32_t slot = 0; slot < m_ids.size(); ++slot) {
+				m_slots[m_ids[slot]] = slot;
+			}
+		}
+		m_bvh.ReleaseIndices();
+	}
+
+	// cos of the half angle of the cone `prim` subtends from `from`; false from inside the sphere.
+	bool LightCone(const Point& from, uint32_t prim, double& cosThetaMax) const {
+		const double radius = m_spheres.Radius(prim);
+		const double distsq = (m_spheres.Center(prim) - from).lengthsq();
+		if (distsq <= radius * radius) {
+			return false;
+		}
+		cosThetaMax = sqrt(1.0 - radius * radius / distsq);
+		return true;
+	}
+
+private:
+	MaterialTable m_materialTable;
+	SphereSet m_spheres;
+	FlatArray<MaterialId> m_materials;
+	// Spheres made of DiffuseLight, as indices into m_spheres.
+	FlatArray<uint32_t> m_lights;
+	BVH m_bvh;
+	AccelMode m_mode;
+	BVH::BuildQuality m_quality;
+	bool m_built;
+	// Keeps memory that the arrays above may view alive, e.g. a mapped scene cache.
+	std::shared_ptr<const void> m_storage;
+	std::vector<std::shared_ptr<const TriangleMesh>> m_meshes;
+	// Number of the first triangle of each mesh.
+	std::vector<uint32_t> m_meshBase;
+	InstanceSet m_instances;
+	// Id of the sphere in each slot, or NO_SPHERE; empty while ids equal slots.
+	FlatArray<SphereId> m_ids;
+	// Slot of each id, or NO_SPHERE; empty until a sphere is changed by id.
+	std::vector<uint32_t> m_slots;
+	size_t m_deadCount;
+	// BVH Cost() when updates began, i.e. of the tree as built.
+	double m_builtCost;
+	double m_rebuildThreshold;
+};
\ No newline at end of file
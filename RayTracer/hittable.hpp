@@ -1,118 +1,126 @@
 #pragma once
 #include "Ray.hpp"
 #include "Utils.hpp"
+#include "AABB.hpp"
 
 #include <cmath>
 #include <vector>
 #include <memory>
 #include <functional>
+#include <cstdint>
 
 using std::vector;
 using std::shared_ptr, std::make_shared;
 using std::sqrt;
 
-class Material;
-typedef shared_ptr<Material> MaterialPtr;
+// Index into the scene's MaterialTable.
+typedef uint32_t MaterialId;
 
-struct HitRecord {
-	HitRecord() = default;
+// Primitive within the Hittable that reported it; only that Hittable knows what it means.
+typedef uint64_t PrimId;
 
-	HitRecord(const Ray & ray, double t_val, Normal outwardNorm, MaterialPtr material) :
+template <typename T>
+struct HitRecordT {
+	HitRecordT() = default;
+
+	// outwardNorm must be unit length.
+	HitRecordT(const RayT<T> & ray, T t_val, Vec3T<T> outwardNorm, MaterialId material) :
 		t(t_val),
 		point(ray.at(t_val)),
-		normal(outwardNorm.unit()),
-		isFrontFace(dot(ray.direction(), outwardNorm) < 0.0),
+		normal(outwardNorm),
+		isFrontFace(dot(ray.direction(), outwardNorm) < 0),
 		mat(material)
 	{
 		normal = isFrontFace ? normal : -normal;
 	}
 
-	double t = 0.0;
+	T t = 0;
 	bool isFrontFace = false;
-	Point point = Vec3();
-	Normal normal = Vec3();
-	MaterialPtr mat;
+	Vec3T<T> point = Vec3T<T>();
+	Vec3T<T> normal = Vec3T<T>();
+	MaterialId mat = 0;
+	PrimId prim = 0;
 
-	void Set(const Ray & ray, double t_val, const Vec3 & outwardNorm, MaterialPtr m) {
-		*this = HitRecord(ray, t_val, outwardNorm, m);
+	void Set(const RayT<T> & ray, T t_val, const Vec3T<T> & outwardNorm, MaterialId m) {
+		*this = HitRecordT(ray, t_val, outwardNorm, m);
 	}
 };
 
+typedef HitRecordT<double> HitRecord;
+
+// Intersection is split in two: Intersect() only narrows down the closest distance and the
+// primitive it belongs to, and FillHitRecord() computes the point, normal, facing and material
+// once for the final winner instead of for every candidate along the way.
 class Hittable abstract {
 public:
-	virtual bool isHit(const Ray& r, HitRecord & rec, double tmin, double tmax) abstract;
+	// Shrinks `closest` and sets `prim` if something is hit within [tmin, closest].
+	virtual bool Intersect(const Ray& r, double tmin, double& closest, PrimId& prim) const abstract;
+	virtual void FillHitRecord(const Ray& r, double t, PrimId prim, HitRecord& rec) const abstract;
+	virtual AABB Bounds() const abstract;
+	// Any-hit query for shadow rays: stops at the first hit within [tmin, tmax], whichever it is.
+	virtual bool isOccluded(const Ray& r, double tmin, double tmax) const abstract;
+
+	bool isHit(const Ray& r, HitRecord & rec, double tmin, double tmax) const {
+		PrimId prim = 0;
+		if (!Intersect(r, tmin, tmax, prim)) {
+			return false;
+		}
+		FillHitRecord(r, tmax, prim, rec);
+		rec.prim = prim;
+		return true;
+	}
 };
 
 class Sphere : public Hittable {
 public:
 
 	Sphere() = delete;
-	Sphere(const Vec3& center, double radius, MaterialPtr mat) : m_center(center), m_radius(radius), m_mat(mat) { }
+	Sphere(const Vec3& center, double radius, MaterialId mat) : m_center(center), m_radius(radius), m_mat(mat) { }
 
-	bool isHit(const Ray& r, HitRecord & rec, double tmin, double tmax) override {
+	bool Intersect(const Ray& r, double tmin, double& tmax, PrimId& prim) const override {
+		// The direction is unit length, so the quadratic's `a` term is 1.
 		auto oc = r.origin() - m_center;
-		auto a = r.direction().lengthsq();
 		auto half_b = dot(r.direction(), oc);
 		auto c = oc.lengthsq() - m_radius * m_radius;
 
-		auto d = half_b * half_b - a * c;
+		auto d = half_b * half_b - c;
 		bool hit = d > 0;
 		if (!hit) {
 			return false;
 		}
 
-		auto root = (- half_b - sqrt(d)) / a;
+		auto root = - half_b - sqrt(d);
 		if (root < tmin || tmax < root) {
 			// Check if the other root is possible.
-			root = (-half_b + sqrt(d)) / a;
+			root = -half_b + sqrt(d);
 			if (root < tmin || tmax < root) {
 				return false;
 			}
 		}
 
-		//rec.t = root;
-		//rec.point = r.at(root);
-		//rec.normal = (rec.point - m_center) / m_radius;
-
-		rec.Set(r, root, r.at(root) - m_center, m_mat);
-
+		tmax = root;
+		prim = 0;
 		return true;
 	}
 
-private:
-	Point m_center;
-	double m_radius;
-	MaterialPtr m_mat;
-};
-
-class World : public Hittable {
-public:
-	World() : m_objects() {}
-
-	void AddSphere(Point center, double radius, MaterialPtr mat) {
-		m_objects.push_back(make_shared<Sphere>(center, radius, mat));
+	void FillHitRecord(const Ray& r, double t, PrimId, HitRecord& rec) const override {
+		// Dividing by |radius| keeps the normal outward for hollow (negative radius) spheres too.
+		rec.Set(r, t, (r.at(t) - m_center) / fabs(m_radius), m_mat);
 	}
 
-	bool isHit(const Ray & r, HitRecord & rec, double tmin, double tmax) override {
-		HitRecord temprec;
-		double closest = tmax;
-		bool hit = false;
-		for (auto& object : m_objects) {
-			if (object->isHit(r, temprec, tmin, closest)) {
-				hit = true;
-				closest = temprec.t;
-			}
-		}
-		if (hit) {
-			rec = temprec;
-		}
-		return hit;
+	AABB Bounds() const override {
+		// Hollow spheres are modelled with a negative radius.
+		const double r = fabs(m_radius);
+		return AABB(m_center - Vec3(r, r, r), m_center + Vec3(r, r, r));
 	}
 
-	void Clear() {
-		m_objects.clear();
+	bool isOccluded(const Ray& r, double tmin, double tmax) const override {
+		PrimId prim = 0;
+		return Intersect(r, tmin, tmax, prim);
 	}
 
 private:
-	vector<shared_ptr<Hittable>> m_objects;
+	Point m_center;
+	double m_radius;
+	MaterialId m_mat;
 };
\ No newline at end of file
@@ -5,8 +5,12 @@
 
 //#include <SDL.h>
 
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <string>
 
 using std::cout;
 using std::endl;
@@ -15,25 +19,270 @@ using std::setw;
 
 #define PRINT_CONFIG(name, val) cout << setw(10) << left << name << ':' << setw(10) << val << endl;
 
-int main() {
-    const char* filename = "output.bmp";
-    const size_t width = 400;
-    const size_t height = 225;
+int main(int argc, char** argv) {
+    std::string filename = "output.bmp";
+    size_t width = 400;
+    size_t height = 225;
+    size_t threads = 0;
+    uint64_t seed = 1;
+    World::AccelMode accel = World::AccelMode::BVH;
+    BVH::BuildQuality buildQuality = BVH::BuildQuality::High;
+    RayTracer::BuiltinScene scene = RayTracer::BuiltinScene::Default;
+    int maxDepth = 50;
+    int samples = 4;
+    int minSamples = 4;
+    double targetError = 0.0;
+    const char* sampleMap = nullptr;
+    bool benchPrecision = false;
+    bool checkUpdates = false;
+    bool nextEventEstimation = true;
+    SamplerType sampler = SamplerType::Sobol;
+    const char* checkpoint = nullptr;
+    double checkpointInterval = 300.0;
+    bool resume = false;
+    const char* sceneFile = nullptr;
+    bool sceneCache = true;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--accel") == 0 && i + 1 < argc) {
+            accel = strcmp(argv[++i], "linear") == 0 ? World::AccelMode::Linear : World::AccelMode::BVH;
+        }
+        else if (strcmp(argv[i], "--bvh-quality") == 0 && i + 1 < argc) {
+            ++i;
+            buildQuality = strcmp(argv[i], "fast") == 0 ? BVH::BuildQuality::Fast
+                : strcmp(argv[i], "balanced") == 0 ? BVH::BuildQuality::Balanced
+                : BVH::BuildQuality::High;
+        }
+        else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            ++i;
+            scene = strcmp(argv[i], "mixed") == 0 ? RayTracer::BuiltinScene::Mixed
+                : strcmp(argv[i], "enclosed") == 0 ? RayTracer::BuiltinScene::Enclosed
+                : RayTracer::BuiltinScene::Default;
+        }
+        else if (strcmp(argv[i], "--scene-file") == 0 && i + 1 < argc) {
+            sceneFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-scene-cache") == 0) {
+            sceneCache = false;
+        }
+        else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+            maxDepth = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            samples = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--min-samples") == 0 && i + 1 < argc) {
+            minSamples = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--target-error") == 0 && i + 1 < argc) {
+            targetError = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--sample-map") == 0 && i + 1 < argc) {
+            sampleMap = argv[++i];
+        }
+        else if (strcmp(argv[i], "--sampler") == 0 && i + 1 < argc) {
+            ++i;
+            sampler = strcmp(argv[i], "independent") == 0 ? SamplerType::Independent
+                : strcmp(argv[i], "bluenoise") == 0 ? SamplerType::BlueNoise
+                : SamplerType::Sobol;
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            checkpoint = argv[++i];
+        }
+        else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc) {
+            checkpointInterval = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--resume") == 0) {
+            resume = true;
+        }
+        else if (strcmp(argv[i], "--no-nee") == 0) {
+            nextEventEstimation = false;
+        }
+        else if (strcmp(argv[i], "--bench-precision") == 0) {
+            benchPrecision = true;
+        }
+        else if (strcmp(argv[i], "--check-updates") == 0) {
+            checkUpdates = true;
+        }
+        else {
+            cout << "Usage: " << argv[0] << " [--threads N] [--seed S] [--accel bvh|linear] [--bvh-quality fast|balanced|high] [--scene default|mixed|enclosed]"
+                " [--scene-file file.scene] [--no-scene-cache]"
+                " [--max-depth D] [--samples N] [--min-samples N] [--target-error E] [--sample-map file.bmp]"
+                " [--sampler sobol|bluenoise|independent] [--no-nee] [--checkpoint file] [--checkpoint-interval S]"
+                " [--resume] [--bench-precision] [--check-updates]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // A scene file replaces the built-in scene, and its output, samples and maxdepth
+    // statements take precedence over the command line. With a BVH the parsed and built scene
+    // is cached next to the file, and later runs map the cache instead of parsing.
+    SceneFile sceneDescription;
+    std::unique_ptr<World> world;
+    if (sceneFile) {
+        world = std::make_unique<World>();
+        world->SetBuildQuality(buildQuality);
+        const std::string cachePath = std::string(sceneFile) + ".rtcache";
+        const bool useCache = sceneCache && accel == World::AccelMode::BVH;
+
+        auto loadStart = std::chrono::steady_clock::now();
+        if (useCache && SceneCache::Load(cachePath, sceneFile, sceneDescription, *world)) {
+            std::chrono::duration<double, std::milli> loadTime = std::chrono::steady_clock::now() - loadStart;
+            cout << "Scene mapped from " << cachePath << ": " << world->Spheres().Size() << " spheres, "
+                << world->MaterialCount() << " materials, " << world->BVHNodeCount() << " BVH nodes in "
+                << loadTime.count() << "ms" << endl;
+        }
+        else {
+            // One pool serves mesh loading and the cache build.
+            ThreadPool pool(threads ? threads : std::thread::hardware_concurrency());
+            std::string error;
+            if (!sceneDescription.Load(sceneFile, *world, error, &pool)) {
+                cout << error << endl;
+                return EXIT_FAILURE;
+            }
+            std::chrono::duration<double> parseTime = std::chrono::steady_clock::now() - loadStart;
+            cout << "Scene parsed: " << world->Spheres().Size() << " spheres, " << world->MaterialCount() << " materials in "
+                << parseTime.count() * 1000 << "ms";
+            if (world->MeshCount()) {
+                // Mesh loading dominates, so a rate over the scene file alone means nothing.
+                const size_t triangles = world->MeshTriangleCount();
+                cout << ", including " << world->MeshCount() << " meshes with " << triangles << " triangles, "
+                    << world->MeshMemoryBytes() / triangles << " bytes per triangle with their BVHs" << endl;
+            }
+            else {
+                cout << " (" << sceneDescription.ByteCount() / parseTime.count() * 1e-6 << " MB/s)" << endl;
+            }
+
+            if (useCache) {
+                auto buildStart = std::chrono::steady_clock::now();
+                world->Build(&pool);
+                std::chrono::duration<double, std::milli> buildTime = std::chrono::steady_clock::now() - buildStart;
+                cout << "BVH built: " << world->BVHNodeCount() << " nodes in " << buildTime.count() << "ms ("
+                    << (world->Spheres().Size() + world->Instances().Size()) / buildTime.count() * 1e-3 << " Mprims/s)" << endl;
+                if (SceneCache::Write(cachePath, sceneFile, sceneDescription, *world)) {
+                    cout << "Scene cache written to " << cachePath << '.' << endl;
+                }
+            }
+            const InstanceSet& instances = world->Instances();
+            if (!instances.Empty()) {
+                cout << "Instances: " << instances.Size() << " of " << instances.ObjectCount() << " objects, "
+                    << instances.MemoryBytes() / instances.Size() << " bytes per instance including the top-level BVH, "
+                    << instances.ObjectMemoryBytes() / 1024 << " KiB of shared geometry" << endl;
+            }
+        }
+
+        const SceneFile::Options& options = sceneDescription.GetOptions();
+        if (options.width) {
+            width = options.width;
+            height = options.height;
+        }
+        if (!options.output.empty()) {
+            filename = options.output;
+        }
+        if (options.samples) {
+            samples = options.samples;
+            minSamples = options.minSamples ? options.minSamples : samples;
+            targetError = options.targetError;
+        }
+        if (options.maxDepth) {
+            maxDepth = options.maxDepth;
+        }
+    }
+
+    RayTracer raytracer(width, height, threads);
+    raytracer.SetSeed(seed);
+    raytracer.SetAccelMode(accel);
+    raytracer.SetBuildQuality(buildQuality);
+    raytracer.SetScene(scene);
+    raytracer.SetMaxDepth(maxDepth);
+    raytracer.SetNextEventEstimation(nextEventEstimation);
+    raytracer.SetSampler(sampler);
+    raytracer.SetSampling(minSamples, samples, targetError);
+    if (world) {
+        raytracer.SetWorld(std::move(world), sceneDescription.MakeCamera(width, height), sceneDescription.ContentHash());
+        if (sceneDescription.GetOptions().background) {
+            raytracer.SetBackground(*sceneDescription.GetOptions().background);
+        }
+    }
+    if (checkpoint) {
+        raytracer.SetCheckpoint(checkpoint, checkpointInterval);
+    }
+
+    if (benchPrecision) {
+        raytracer.BenchmarkPrecision();
+        return EXIT_SUCCESS;
+    }
+    if (checkUpdates) {
+        return raytracer.CheckUpdates() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
     cout << "Raytracer running with the following configuration" << endl;
     PRINT_CONFIG("Width", width);
     PRINT_CONFIG("Height", height);
+    PRINT_CONFIG("Threads", raytracer.GetThreadCount());
+    PRINT_CONFIG("Seed", seed);
+    PRINT_CONFIG("Accel", (accel == World::AccelMode::BVH ? "bvh" : "linear"));
+    PRINT_CONFIG("SIMD", SphereSet::KernelName());
+    PRINT_CONFIG("BVH build", (buildQuality == BVH::BuildQuality::Fast ? "fast"
+        : buildQuality == BVH::BuildQuality::Balanced ? "balanced" : "high"));
+    PRINT_CONFIG("Scene", (sceneFile ? sceneFile : scene == RayTracer::BuiltinScene::Mixed ? "mixed"
+        : scene == RayTracer::BuiltinScene::Enclosed ? "enclosed" : "default"));
+    PRINT_CONFIG("Max depth", maxDepth);
+    PRINT_CONFIG("NEE", (nextEventEstimation ? "on" : "off"));
+    PRINT_CONFIG("Sampler", (sampler == SamplerType::Independent ? "independent"
+        : sampler == SamplerType::BlueNoise ? "bluenoise" : "sobol"));
+    PRINT_CONFIG("Samples", samples);
+    if (targetError > 0.0) {
+        PRINT_CONFIG("Min samp.", minSamples);
+        PRINT_CONFIG("Target err", targetError);
+    }
     PRINT_CONFIG("Filename", filename);
+    if (checkpoint) {
+        PRINT_CONFIG("Checkpoint", checkpoint);
+    }
+
+    // Resuming continues the checkpointed render, so every setting above must match it.
+    if (resume && !raytracer.Resume()) {
+        if (!checkpoint) {
+            cout << "--resume needs --checkpoint to name the file to resume from." << endl;
+        }
+        return EXIT_FAILURE;
+    }
 
-    RayTracer raytracer(width, height);
+    auto start = std::chrono::steady_clock::now();
     raytracer.Run();
-    cout << "Raytracer successfully run, beginning to write to file..." << endl;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    cout << endl << "Raytracer successfully run in " << elapsed.count() << "s, beginning to write to file..." << endl;
 
     // Write to file.
     auto bitmap = raytracer.GetBitmap();
     stbi_flip_vertically_on_write(true); // Bugs
-    stbi_write_bmp(filename, width, height, 3, bitmap);
+    stbi_write_bmp(filename.c_str(), width, height, 3, bitmap);
     cout << "Image written to file " << filename << '.' << endl;
 
+    // Linear HDR copies of the same image, named after it.
+    const std::string stem = filename.substr(0, filename.rfind('.'));
+    const std::string pfmFilename = stem + ".pfm";
+    const std::string exrFilename = stem + ".exr";
+    const Framebuffer& framebuffer = raytracer.GetFramebuffer();
+    if (framebuffer.WritePFM(pfmFilename.c_str())) {
+        cout << "HDR image written to file " << pfmFilename << '.' << endl;
+    }
+    if (framebuffer.WriteEXR(exrFilename.c_str())) {
+        cout << "HDR image written to file " << exrFilename << '.' << endl;
+    }
+
+    if (sampleMap) {
+        auto counts = raytracer.GetSampleCountBitmap();
+        stbi_write_bmp(sampleMap, width, height, 3, counts.data());
+        cout << "Sample counts written to file " << sampleMap << '.' << endl;
+    }
+
     return EXIT_SUCCESS;
 }
\ No newline at end of file